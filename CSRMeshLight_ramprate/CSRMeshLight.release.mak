@@ -52,6 +52,9 @@ INPUTS=\
       battery_hw.c\
       fast_pwm.c\
       app_data_stream.c\
+      light_ramp.c\
+      app_trace.c\
+      soft_timer.c\
       pio_ctrlr_code.asm\
       $(DBS)
 
@@ -15,6 +15,17 @@
  *       LEN - if MS Bit of First octet is 1, then len is 2 octets
  *       if(data[0] & 0x80) LEN = data[0]
  *
+ *    When ENABLE_NVM_STATS is defined, CSR_NVM_STATS_REQ is answered with
+ *    CSR_NVM_STATS_RSP, carrying for each NVM access site, in the order of
+ *    nvm_stats_site and little endian: count (2 octets), words (4), total
+ *    time (4), maximum time (4) in microseconds and failures recovered (2).
+ *
+ *    When ENABLE_MESH_EVENT_STATS is defined, CSR_MESH_EVENT_STATS_REQ is
+ *    answered with CSR_MESH_EVENT_STATS_RSP, carrying for each CSRmesh event
+ *    code below MESH_EVENT_TABLE_SIZE, in order and little endian: count,
+ *    minimum, average and maximum processing time in microseconds (2 octets
+ *    each).
+ *
  ******************************************************************************/
 
 /*=============================================================================*
@@ -23,6 +34,7 @@
 #include <gatt.h>
 #include <timer.h>
 #include <mem.h>
+#include <buf_utils.h>
 
 /*============================================================================*
  *  CSR Mesh Header Files
@@ -34,6 +46,9 @@
  *  Local Header Files
 *============================================================================*/
 #include "app_data_stream.h"
+#include "nvm_access.h"
+#include "csr_mesh_light.h"
+#include "soft_timer.h"
 
 #ifdef  ENABLE_DATA_MODEL
 /*=============================================================================*
@@ -56,6 +71,16 @@
 /* Max number of retries */
 #define MAX_SEND_RETRIES                  (3)
 
+#ifdef ENABLE_NVM_STATS
+/* Size of the statistics of an NVM access site in the stream, in octets */
+#define NVM_STATS_SITE_OCTETS             (16)
+#endif /* ENABLE_NVM_STATS */
+
+#ifdef ENABLE_MESH_EVENT_STATS
+/* Size of the statistics of a CSRmesh event code in the stream, in octets */
+#define MESH_EVENT_STATS_OCTETS           (8)
+#endif /* ENABLE_MESH_EVENT_STATS */
+
 /*=============================================================================*
  *  Private Data
  *============================================================================*/
@@ -65,6 +90,21 @@ static uint8 device_info[256];
 /* Device info length */
 static uint8 device_info_length;
 
+#ifdef ENABLE_NVM_STATS
+/* NVM access statistics response */
+static uint8 nvm_stats_info[2 + (nvm_site_count * NVM_STATS_SITE_OCTETS)];
+#endif /* ENABLE_NVM_STATS */
+
+#ifdef ENABLE_MESH_EVENT_STATS
+/* CSRmesh event statistics response */
+static uint8 mesh_event_stats_info[2 + (MESH_EVENT_TABLE_SIZE *
+                                        MESH_EVENT_STATS_OCTETS)];
+#endif /* ENABLE_MESH_EVENT_STATS */
+
+/* Data being sent and its length, including the CODE and LEN octets */
+static uint8 *tx_stream_data;
+static uint16 tx_stream_length;
+
 /* Stream bytes sent tracker */
 static uint16 tx_stream_offset = 0;
 
@@ -80,8 +120,8 @@ static uint16 rx_stream_offset = 0;
 /* Rx Stream status flag */
 static bool rx_stream_in_progress = FALSE;
 
-/* Rx stream timeout tid */
-static timer_id rx_stream_timeout_tid;
+/* Rx stream timeout timer */
+static SOFT_TIMER_T rx_stream_timer;
 
 static APP_DATA_STREAM_CODE_T current_stream_code;
 
@@ -91,6 +131,13 @@ static APP_DATA_STREAM_CODE_T current_stream_code;
  *============================================================================*/
 static void streamSendRetryTimer(timer_id tid);
 static void sendNextPacket(void);
+static void startSending(uint16 target_id, uint8 *data, uint16 length);
+#ifdef ENABLE_NVM_STATS
+static uint16 buildNvmStats(void);
+#endif /* ENABLE_NVM_STATS */
+#ifdef ENABLE_MESH_EVENT_STATS
+static uint16 buildMeshEventStats(void);
+#endif /* ENABLE_MESH_EVENT_STATS */
 
 /*=============================================================================*
  *  Private Function Implementations
@@ -138,16 +185,11 @@ static void streamSendRetryTimer(timer_id tid)
  *      Nothing.
  *
  *---------------------------------------------------------------------------*/
-static void rxStreamTimeoutHandler(timer_id tid)
+static void rxStreamTimeoutHandler(void)
 {
-    if( tid == rx_stream_timeout_tid )
-    {
-        /* Reset the stream */
-        rx_stream_timeout_tid = TIMER_INVALID;
-        rx_stream_in_progress = FALSE;
-        StreamReset();
-
-    }
+    /* Reset the stream */
+    rx_stream_in_progress = FALSE;
+    StreamReset();
 }
 
 /*-----------------------------------------------------------------------------*
@@ -171,14 +213,14 @@ static void sendNextPacket(void)
     TimerDelete(stream_send_retry_tid);
     stream_send_retry_tid = TIMER_INVALID;
 
-    data_pending = device_info_length+2 - tx_stream_offset;
+    data_pending = tx_stream_length - tx_stream_offset;
 
     if( data_pending )
     {
         len = (data_pending > STREAM_DATA_BLOCK_SIZE_MAX)? STREAM_DATA_BLOCK_SIZE_MAX:data_pending;
 
         /* Send the next packet */
-        StreamSendData(&device_info[tx_stream_offset], len);
+        StreamSendData(&tx_stream_data[tx_stream_offset], len);
         tx_stream_offset += len;
 
         stream_send_retry_tid = TimerCreate(100 * MILLISECOND, TRUE,
@@ -191,6 +233,108 @@ static void sendNextPacket(void)
     }
 }
 
+/*-----------------------------------------------------------------------------*
+ *  NAME
+ *      startSending
+ *
+ *  DESCRIPTION
+ *      Starts sending data to the given device over the stream
+ *
+ *  RETURNS/MODIFIES
+ *      Nothing
+ *
+ *----------------------------------------------------------------------------*/
+static void startSending(uint16 target_id, uint8 *data, uint16 length)
+{
+    /* Set the device ID as the stream target device */
+    StreamStartSender(target_id);
+    tx_stream_data = data;
+    tx_stream_length = length;
+    tx_stream_offset = 0;
+
+    /* Start sending */
+    sendNextPacket();
+}
+
+#ifdef ENABLE_NVM_STATS
+/*-----------------------------------------------------------------------------*
+ *  NAME
+ *      buildNvmStats
+ *
+ *  DESCRIPTION
+ *      Fills the NVM access statistics response with the statistics of all
+ *      the NVM access sites
+ *
+ *  RETURNS/MODIFIES
+ *      Length of the response in octets
+ *
+ *----------------------------------------------------------------------------*/
+static uint16 buildNvmStats(void)
+{
+    NVM_SITE_STATS_T stats;
+    nvm_stats_site site;
+    uint8 *p_data = &nvm_stats_info[2];
+
+    nvm_stats_info[0] = CSR_NVM_STATS_RSP;
+    nvm_stats_info[1] = nvm_site_count * NVM_STATS_SITE_OCTETS;
+
+    for(site = nvm_site_load; site < nvm_site_count; site++)
+    {
+        Nvm_GetStats(site, &stats);
+        BufWriteUint16(&p_data, stats.count);
+        BufWriteUint32(&p_data, &stats.words);
+        BufWriteUint32(&p_data, &stats.total_time);
+        BufWriteUint32(&p_data, &stats.max_time);
+        BufWriteUint16(&p_data, stats.recovered);
+    }
+
+    return sizeof(nvm_stats_info);
+}
+#endif /* ENABLE_NVM_STATS */
+
+#ifdef ENABLE_MESH_EVENT_STATS
+/*-----------------------------------------------------------------------------*
+ *  NAME
+ *      buildMeshEventStats
+ *
+ *  DESCRIPTION
+ *      Fills the CSRmesh event statistics response with the statistics of
+ *      all the event codes of the handler table
+ *
+ *  RETURNS/MODIFIES
+ *      Length of the response in octets
+ *
+ *----------------------------------------------------------------------------*/
+static uint16 buildMeshEventStats(void)
+{
+    MESH_EVENT_STATS_T stats;
+    uint32 average;
+    uint16 event_code;
+    uint8 *p_data = &mesh_event_stats_info[2];
+
+    mesh_event_stats_info[0] = CSR_MESH_EVENT_STATS_RSP;
+    mesh_event_stats_info[1] = MESH_EVENT_TABLE_SIZE * MESH_EVENT_STATS_OCTETS;
+
+    for(event_code = 0; event_code < MESH_EVENT_TABLE_SIZE; event_code++)
+    {
+        AppGetMeshEventStats((csr_mesh_event_t)event_code, &stats);
+
+        average = (stats.count != 0) ? (stats.total_time / stats.count) : 0;
+        if(average > 0xFFFF)
+        {
+            average = 0xFFFF;
+        }
+
+        BufWriteUint16(&p_data, stats.count);
+        BufWriteUint16(&p_data, stats.min_time);
+        BufWriteUint16(&p_data, (uint16)average);
+        BufWriteUint16(&p_data, stats.max_time);
+    }
+
+    return sizeof(mesh_event_stats_info);
+}
+#endif /* ENABLE_MESH_EVENT_STATS */
+
 /*=============================================================================*
  *  Public Function Implementations
  *============================================================================*/
@@ -213,7 +357,7 @@ extern void AppDataStreamInit(uint16 *group_id_list, uint16 num_groups)
 
     /* Reset timers */
     stream_send_retry_tid = TIMER_INVALID;
-    rx_stream_timeout_tid = TIMER_INVALID;
+    SoftTimerStop(&rx_stream_timer);
 
     /* Reset the device info */
     device_info_length = sizeof(DEVICE_INFO_STRING);
@@ -241,16 +385,14 @@ extern void handleCSRmeshDataStreamFlushInd(CSR_MESH_STREAM_EVENT_T *p_event)
     if( rx_stream_in_progress == FALSE )
     {
         /* Start the stream timeout timer */
-        TimerDelete(rx_stream_timeout_tid);
-        rx_stream_timeout_tid = TimerCreate(RX_STREAM_TIMEOUT, TRUE,
-                                                        rxStreamTimeoutHandler);
+        SoftTimerStart(&rx_stream_timer, RX_STREAM_TIMEOUT,
+                       rxStreamTimeoutHandler);
     }
     else
     {
         /* End of stream */
         rx_stream_in_progress = FALSE;
-        TimerDelete(rx_stream_timeout_tid);
-        rx_stream_timeout_tid = TIMER_INVALID;
+        SoftTimerStop(&rx_stream_timer);
     }
 }
 
@@ -271,16 +413,34 @@ extern void handleCSRmeshDataBlockInd(CSR_MESH_STREAM_EVENT_T *p_event)
     {
         case CSR_DEVICE_INFO_REQ:
         {
-            /* Set the source device ID as the stream target device */
-            StreamStartSender(p_event->common_data.source_id );
-            tx_stream_offset = 0;
             /* Set the opcode to CSR_DEVICE_INFO_RSP */
             device_info[0] = CSR_DEVICE_INFO_RSP;
 
-            /* start sending the data */
-            sendNextPacket();
+            /* start sending the data to the source device */
+            startSending(p_event->common_data.source_id, device_info,
+                         device_info_length + 2);
+        }
+        break;
+
+#ifdef ENABLE_NVM_STATS
+        case CSR_NVM_STATS_REQ:
+        {
+            /* Send the NVM access statistics to the source device */
+            startSending(p_event->common_data.source_id, nvm_stats_info,
+                         buildNvmStats());
         }
         break;
+#endif /* ENABLE_NVM_STATS */
+
+#ifdef ENABLE_MESH_EVENT_STATS
+        case CSR_MESH_EVENT_STATS_REQ:
+        {
+            /* Send the CSRmesh event statistics to the source device */
+            startSending(p_event->common_data.source_id, mesh_event_stats_info,
+                         buildMeshEventStats());
+        }
+        break;
+#endif /* ENABLE_MESH_EVENT_STATS */
 
         case CSR_DEVICE_INFO_RESET:
         {
@@ -312,9 +472,8 @@ extern void handleCSRmeshDataBlockInd(CSR_MESH_STREAM_EVENT_T *p_event)
 extern void handleCSRmeshDataStreamDataInd(CSR_MESH_STREAM_EVENT_T *p_event)
 {
     /* Restart the stream timeout timer */
-    TimerDelete(rx_stream_timeout_tid);
-    rx_stream_timeout_tid = TimerCreate(RX_STREAM_TIMEOUT, TRUE,
-                                                    rxStreamTimeoutHandler);
+    SoftTimerStart(&rx_stream_timer, RX_STREAM_TIMEOUT,
+                   rxStreamTimeoutHandler);
 
     /* Set stream_in_progress flag to TRUE */
     rx_stream_in_progress = TRUE;
@@ -326,15 +485,33 @@ extern void handleCSRmeshDataStreamDataInd(CSR_MESH_STREAM_EVENT_T *p_event)
         {
             case CSR_DEVICE_INFO_REQ:
             {
-                /* Set the source device ID as the stream target device */
-                StreamStartSender(p_event->common_data.source_id);
-                tx_stream_offset = 0;
                 /* Set the stream code to CSR_DEVICE_INFO_RSP */
                 device_info[0] = CSR_DEVICE_INFO_RSP;
-                /* Start sending */
-                sendNextPacket();
+                /* Start sending to the source device */
+                startSending(p_event->common_data.source_id, device_info,
+                             device_info_length + 2);
+            }
+            break;
+
+#ifdef ENABLE_NVM_STATS
+            case CSR_NVM_STATS_REQ:
+            {
+                /* Send the NVM access statistics to the source device */
+                startSending(p_event->common_data.source_id, nvm_stats_info,
+                             buildNvmStats());
+            }
+            break;
+#endif /* ENABLE_NVM_STATS */
+
+#ifdef ENABLE_MESH_EVENT_STATS
+            case CSR_MESH_EVENT_STATS_REQ:
+            {
+                /* Send the CSRmesh event statistics to the source device */
+                startSending(p_event->common_data.source_id,
+                             mesh_event_stats_info, buildMeshEventStats());
             }
             break;
+#endif /* ENABLE_MESH_EVENT_STATS */
 
             case CSR_DEVICE_INFO_RESET:
             {
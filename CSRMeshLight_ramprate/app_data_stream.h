@@ -46,7 +46,11 @@ typedef enum
     CSR_DEVICE_INFO_REQ = 0x01,
     CSR_DEVICE_INFO_RSP = 0x02,
     CSR_DEVICE_INFO_SET = 0x03,
-    CSR_DEVICE_INFO_RESET = 0x04
+    CSR_DEVICE_INFO_RESET = 0x04,
+    CSR_NVM_STATS_REQ = 0x05,
+    CSR_NVM_STATS_RSP = 0x06,
+    CSR_MESH_EVENT_STATS_REQ = 0x07,
+    CSR_MESH_EVENT_STATS_RSP = 0x08
 }APP_DATA_STREAM_CODE_T;
 
 /*============================================================================*
@@ -169,6 +169,11 @@ typedef enum
     /* Failure while erasing NVM */
     app_panic_nvm_erase,
 
+    /* Brightness look up table not strictly increasing, reported only if
+     * ENABLE_LEVEL_LUT_CHECK is defined
+     */
+    app_panic_level_lut,
+
 }app_panic_code;
 
 
@@ -182,13 +187,4 @@ typedef enum
  */
 extern void ReportPanic(app_panic_code panic_code);
 
-
-#ifdef NVM_TYPE_FLASH
-/* This function writes the application data to NVM. This function should 
- * be called on getting nvm_status_needs_erase
- */
-extern void WriteApplicationAndServiceDataToNVM(void);
-#endif /* NVM_TYPE_FLASH */
-
-
 #endif /* __APP_GATT_H__ */
@@ -0,0 +1,209 @@
+/******************************************************************************
+ *  Copyright Cambridge Silicon Radio Limited 2015
+ *  CSR Bluetooth Low Energy CSRmesh 1.3 Release
+ *  Application version 1.3
+ *
+ *  FILE
+ *      app_trace.c
+ *
+ *  DESCRIPTION
+ *      This file implements the application trace ring. Trace points copy a
+ *      four word record in a RAM ring, which a timer drains to the debug UART
+ *      one record per tick. When the ring is full the new records are dropped
+ *      and counted, and the count is reported as a trace_dropped record once
+ *      the ring has room again.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+#include <timer.h>
+#include <time.h>
+#include <debug.h>
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+#include "app_trace.h"
+
+#ifdef ENABLE_TRACE
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Number of records in the ring. Must be a power of two */
+#define TRACE_RING_RECORDS          (32)
+
+/* Mask applied to the ring indexes */
+#define TRACE_RING_MASK             (TRACE_RING_RECORDS - 1)
+
+/* Words in a record: id, timestamp, arg1, arg2 */
+#define TRACE_RECORD_WORDS          (4)
+
+/* Interval between two records written to the UART. A record line is 17
+ * characters, which fits the UART buffer and leaves it time to drain.
+ */
+#define TRACE_DRAIN_INTERVAL        (20 * MILLISECOND)
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* Trace records */
+static uint16 trace_ring[TRACE_RING_RECORDS][TRACE_RECORD_WORDS];
+
+/* Index of the oldest record in the ring */
+static uint16 trace_head;
+
+/* Number of records in the ring */
+static uint16 trace_count;
+
+/* Number of records dropped since the last trace_dropped record */
+static uint16 trace_dropped_count;
+
+/* Timer draining the ring to the UART */
+static timer_id trace_drain_tid;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+static void storeRecord(app_trace_id id, uint16 arg1, uint16 arg2);
+static void drainTimerHandler(timer_id tid);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      storeRecord
+ *
+ *  DESCRIPTION
+ *      This function copies a record at the tail of the ring, which must not
+ *      be full.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void storeRecord(app_trace_id id, uint16 arg1, uint16 arg2)
+{
+    uint16 *record = trace_ring[(trace_head + trace_count) & TRACE_RING_MASK];
+
+    record[0] = id;
+    record[1] = TimeGet16();
+    record[2] = arg1;
+    record[3] = arg2;
+    trace_count++;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      drainTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function writes the oldest record of the ring to the UART, and
+ *      restarts itself while records are left.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void drainTimerHandler(timer_id tid)
+{
+    const uint16 *record;
+
+    if(tid != trace_drain_tid)
+    {
+        return;
+    }
+    trace_drain_tid = TIMER_INVALID;
+
+    if(trace_count == 0)
+    {
+        return;
+    }
+
+    record = trace_ring[trace_head];
+    DebugWriteString("~");
+    DebugWriteUint8((uint8)record[0]);
+    DebugWriteUint16(record[1]);
+    DebugWriteUint16(record[2]);
+    DebugWriteUint16(record[3]);
+    DebugWriteString("\r\n");
+
+    trace_head = (trace_head + 1) & TRACE_RING_MASK;
+    trace_count--;
+
+    /* Report the records lost while the ring was full */
+    if(trace_dropped_count != 0)
+    {
+        storeRecord(trace_dropped, trace_dropped_count, 0);
+        trace_dropped_count = 0;
+    }
+
+    if(trace_count != 0)
+    {
+        trace_drain_tid = TimerCreate(TRACE_DRAIN_INTERVAL, TRUE,
+                                      drainTimerHandler);
+    }
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AppTraceInit
+ *
+ *  DESCRIPTION
+ *      This function empties the trace ring. It must be called after the
+ *      timers have been initialised.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void AppTraceInit(void)
+{
+    trace_head = 0;
+    trace_count = 0;
+    trace_dropped_count = 0;
+    trace_drain_tid = TIMER_INVALID;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AppTrace
+ *
+ *  DESCRIPTION
+ *      This function stores a trace record in the ring, or counts it as
+ *      dropped if the ring is full, and starts the drain timer if it is not
+ *      running.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void AppTrace(app_trace_id id, uint16 arg1, uint16 arg2)
+{
+    if(trace_count == TRACE_RING_RECORDS)
+    {
+        trace_dropped_count++;
+        return;
+    }
+
+    storeRecord(id, arg1, arg2);
+
+    if(trace_drain_tid == TIMER_INVALID)
+    {
+        trace_drain_tid = TimerCreate(TRACE_DRAIN_INTERVAL, TRUE,
+                                      drainTimerHandler);
+    }
+}
+
+#endif /* ENABLE_TRACE */
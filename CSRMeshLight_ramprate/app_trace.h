@@ -0,0 +1,104 @@
+/******************************************************************************
+ *  Copyright Cambridge Silicon Radio Limited 2015
+ *  CSR Bluetooth Low Energy CSRmesh 1.3 Release
+ *  Application version 1.3
+ *
+ *  FILE
+ *      app_trace.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the application trace ring. A trace point only
+ *      stores a binary record in RAM; the records are written to the debug
+ *      UART later, from a timer, so the event handlers do not wait on the
+ *      UART.
+ *
+ *      Each record is written as one line of fixed width hex fields, with no
+ *      separators: '~', id (2 digits), TimeGet16() timestamp in microseconds
+ *      (4 digits), first argument (4 digits), second argument (4 digits).
+ *
+ *****************************************************************************/
+
+#ifndef __APP_TRACE_H__
+#define __APP_TRACE_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "user_config.h"
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Trace record identifiers. The meaning of the arguments is given for each
+ * identifier; unused arguments are 0. Append new identifiers at the end so
+ * the logs captured with older builds still decode.
+ */
+typedef enum
+{
+    /* Number of records lost because the ring was full */
+    trace_dropped = 0,
+
+    /* System event. arg1: sys_event_id */
+    trace_system_event,
+
+    /* LM event. arg1: lm_event_code */
+    trace_lm_event,
+
+    /* CSRmesh event. arg1: csr_mesh_event_t */
+    trace_mesh_event,
+
+    /* Device ID assigned. arg1: device ID */
+    trace_device_id,
+
+    /* Light level set. arg1: level */
+    trace_set_level,
+
+    /* Light colour set. arg1: red << 8 | green, arg2: blue */
+    trace_set_rgb,
+
+    /* Colour temperature set. arg1: colour temperature */
+    trace_set_colour_temp,
+
+    /* Power state set. arg1: power state */
+    trace_set_power
+
+} app_trace_id;
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+#ifdef ENABLE_TRACE
+
+/* Records a trace point */
+#define TRACE(id, arg1, arg2)       AppTrace((id), (arg1), (arg2))
+
+#else
+
+#define TRACE(id, arg1, arg2)
+
+#endif /* ENABLE_TRACE */
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+#ifdef ENABLE_TRACE
+
+/* Empties the trace ring. Must be called after TimerInit */
+extern void AppTraceInit(void);
+
+/* Stores a trace record in the ring */
+extern void AppTrace(app_trace_id id, uint16 arg1, uint16 arg2);
+
+#endif /* ENABLE_TRACE */
+
+#endif /* __APP_TRACE_H__ */
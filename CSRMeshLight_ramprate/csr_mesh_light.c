@@ -18,6 +18,7 @@
 #include <ls_app_if.h>
 #include <gatt.h>
 #include <timer.h>
+#include <time.h>
 #include <uart.h>
 #include <pio.h>
 #include <nvm.h>
@@ -55,6 +56,8 @@
 #endif /* USE_ASSOCIATION_REMOVAL_KEY */
 #include "battery_hw.h"
 #include "app_data_stream.h"
+#include "app_trace.h"
+#include "soft_timer.h"
 
 /*============================================================================*
  *  CSR Mesh Header Files
@@ -115,10 +118,19 @@
 /* OTA Reset Defer Duration */
 #define OTA_RESET_DEFER_DURATION       (500 * MILLISECOND)
 
+/* Offset of the optional transition duration (in milliseconds) in the
+ * CSR_MESH_LIGHT_SET_RGB event data.
+ */
+#define LIGHT_SET_RGB_DURATION_OFFSET  (4)
+
 /* NVM Data Write defer Duration */
 #define NVM_WRITE_DEFER_DURATION       (5 * SECOND)
 
-#define MAX_APP_TIMERS                 (10 + MAX_CSR_MESH_TIMERS)
+/* Application timers, including the colour ramp and dither timers of the light
+ * hardware, the NVM compaction timer, the trace drain timer and the timer
+ * shared by the software timers
+ */
+#define MAX_APP_TIMERS                 (12 + MAX_CSR_MESH_TIMERS)
 
 /* Advertisement Timer for sending device identification */
 #define DEVICE_ID_ADVERT_TIME          (5 * SECOND)
@@ -152,6 +164,9 @@
 /* APP NVM version used by the 1.1 light application */
 #define APP_NVM_VERSION_1_1            (2)
 
+/* APP NVM version of the 1.3 layout, before the sequence number ring */
+#define APP_NVM_VERSION_4              (4)
+
 /* Magic value to check the sanity of NVM region used by the application. This 
  * value should be unique for each application as the NVM layout changes for
  * every application.
@@ -231,6 +246,139 @@
 #define NVM_MAX_APP_MEMORY_WORDS       (NVM_BEARER_DATA_OFFSET + \
                                         sizeof(BEARER_MODEL_STATE_DATA_T))
 
+/* Number of records in the sequence number ring. Each update of the sequence
+ * number is written to the next record, which spreads the wear over all of
+ * them. On SPI flash the ring follows the GAP service data in the NVM shadow,
+ * as the log spreads the commits anyway. On EEPROM it is kept beyond the
+ * shadow and written directly, so that updating it does not commit the
+ * shadow and rewrite the slot header every time.
+ */
+#define SEQ_RING_RECORDS               (8)
+
+/* Size of a sequence number record in words: the sequence number, low word
+ * first, followed by a check word.
+ */
+#define SEQ_RING_RECORD_WORDS          (3)
+
+/* Size of the sequence number ring in words */
+#define SEQ_RING_SIZE_WORDS            (SEQ_RING_RECORDS * \
+                                        SEQ_RING_RECORD_WORDS)
+
+/* Check word of a sequence number record. The value mixed in makes erased
+ * records invalid, and a record torn by a reset fails the check.
+ */
+#define SEQ_RING_CHECK(low, high)      ((low) ^ (high) ^ 0xA55A)
+
+/* Sequence numbers reserved ahead on each update of the ring. The sequence
+ * number restored after a reset is the end of the reservation, so the ring is
+ * written at most once every SEQ_RESERVE_AHEAD sequence numbers.
+ */
+#define SEQ_RESERVE_AHEAD              (128)
+
+/* NVM offsets of the association data used by the 1.1 application. The UUID
+ * and the authorisation code are at the same offsets as in this version.
+ */
+#define NVM_1_1_OFFSET_NETWORK_KEY     (NVM_OFFSET_DEVICE_AUTHCODE + \
+                                        sizeof(CSR_MESH_AUTH_CODE_T) + 2)
+
+#define NVM_1_1_OFFSET_DEVICE_ID       (NVM_1_1_OFFSET_NETWORK_KEY + \
+                                        sizeof(CSR_MESH_NETWORK_KEY_T) + 1)
+
+#define NVM_1_1_OFFSET_SEQUENCE_NUMBER (NVM_1_1_OFFSET_DEVICE_ID + 1)
+
+#define NVM_1_1_OFFSET_DEVICE_ETAG     (NVM_1_1_OFFSET_SEQUENCE_NUMBER + 2)
+
+#define NVM_1_1_OFFSET_ASSOCIATION_STATE \
+                                       (NVM_1_1_OFFSET_DEVICE_ETAG + \
+                                        sizeof(CSR_MESH_ETAG_T))
+
+#ifdef NVM_TYPE_FLASH
+/* Words of the NVM shadow used by the application, the GAP service and the
+ * sequence number ring
+ */
+#define NVM_SHADOW_USED_WORDS          (NVM_MAX_APP_MEMORY_WORDS + \
+                                        GAP_SERVICE_NVM_MEMORY_WORDS + \
+                                        SEQ_RING_SIZE_WORDS)
+#else
+/* NVM offset of the sequence number ring, the first word beyond the shadow */
+#define NVM_SEQ_RING_OFFSET            (NVM_SHADOW_SIZE_WORDS)
+
+/* Words of the NVM shadow used by the application and the GAP service */
+#define NVM_SHADOW_USED_WORDS          (NVM_MAX_APP_MEMORY_WORDS + \
+                                        GAP_SERVICE_NVM_MEMORY_WORDS)
+#endif /* NVM_TYPE_FLASH */
+
+/* Number of entries of a table */
+#define TABLE_SIZE(table)              (sizeof(table) / sizeof((table)[0]))
+
+#ifdef ENABLE_BOOT_TIMING
+/* Record the time at which a phase of AppInit is complete */
+#define BOOT_PHASE_DONE(phase)         (boot_phase_time[(phase)] = TimeGet32())
+#else
+#define BOOT_PHASE_DONE(phase)
+#endif /* ENABLE_BOOT_TIMING */
+
+/* NVM data reset to its defaults when the persistent store is read */
+#define NVM_NEW_LIGHT_STATE            (0x0001)  /* RGB and power state */
+#define NVM_NEW_MODEL_GROUPS           (0x0002)  /* Model group assignments */
+#define NVM_NEW_BEARER_DATA            (0x0004)  /* Bearer model state */
+#define NVM_NEW_GAP_DATA               (0x0008)  /* GAP service data */
+#define NVM_NEW_SEQ_RING               (0x0010)  /* Sequence number ring */
+#define NVM_NEW_ALL                    (0x001F)
+
+/* Field of an earlier NVM layout kept by the migration to the next layout */
+typedef struct
+{
+    /* NVM offset of the field in the earlier layout */
+    uint16                         from_offset;
+
+    /* NVM offset of the field in the next layout */
+    uint16                         to_offset;
+
+    /* Size of the field in words */
+    uint16                         length;
+} NVM_FIELD_MOVE_T;
+
+/* Migration of an earlier NVM layout to the next one */
+typedef struct
+{
+    /* Sanity word and Application NVM version of the earlier layout */
+    uint16                         sanity;
+    uint16                         version;
+
+    /* Fields kept, in increasing NVM offsets. NULL if none move. */
+    const NVM_FIELD_MOVE_T        *p_fields;
+    uint16                         num_fields;
+
+    /* NVM_NEW_x data the next layout adds or moves without keeping it. The
+     * other data is kept in place.
+     */
+    uint16                         new_data;
+} NVM_MIGRATION_T;
+
+/* Actions taken after a CSRmesh event handler returns TRUE */
+#define MESH_EVENT_UPDATE_ETAG         (0x0001)  /* Update the device ETag */
+#define MESH_EVENT_WRITE_LIGHT_STATE   (0x0002)  /* Write the light state to
+                                                  * NVM after a delay
+                                                  */
+
+/* Handler of a CSRmesh event, called with the arguments of
+ * AppProcessCsrMeshEvent. Returns TRUE if the actions flagged for the event
+ * are to be taken.
+ */
+typedef bool (*MESH_EVENT_HANDLER_T)(csr_mesh_event_t event_code, uint8 *data,
+                                     uint16 length, void **state_data);
+
+/* Entry of the CSRmesh event handler table */
+typedef struct
+{
+    /* Handler of the event, NULL if the event is ignored */
+    MESH_EVENT_HANDLER_T           handler;
+
+    /* MESH_EVENT_x actions taken after the handler */
+    uint16                         flags;
+} MESH_EVENT_ENTRY_T;
+
 /*============================================================================*
  *  Public Data
  *============================================================================*/
@@ -303,6 +451,90 @@ static uint16 bearer_relay_active;
  */
 static uint16 bearer_promiscuous;
 
+#ifdef ENABLE_BOOT_TIMING
+/* Phases of AppInit timed at boot */
+typedef enum
+{
+    boot_phase_start = 0,       /* AppInit called */
+    boot_phase_light,           /* Light restored from NVM */
+    boot_phase_store,           /* Persistent store read */
+    boot_phase_mesh,            /* CSRmesh and models initialised */
+    boot_phase_started,         /* CSRmesh started */
+    boot_phase_done,            /* GATT database requested */
+    boot_phase_count
+} boot_phase;
+
+/* Time at which each phase of AppInit completed */
+static uint32 boot_phase_time[boot_phase_count];
+#endif /* ENABLE_BOOT_TIMING */
+
+/* The NVM layout must fit the shadow, or the words past its end would be
+ * written to the NVM directly on every update. The array size is negative,
+ * so the build fails, if it does not fit.
+ */
+typedef char nvm_layout_fits_shadow[(NVM_SHADOW_USED_WORDS <=
+                                     NVM_SHADOW_SIZE_WORDS) ? 1 : -1];
+
+#ifndef NVM_TYPE_FLASH
+/* The sequence number ring must fit the words beyond the shadow */
+typedef char seq_ring_fits_nvm[(SEQ_RING_SIZE_WORDS <=
+                                NVM_BEYOND_SHADOW_WORDS) ? 1 : -1];
+#endif /* NVM_TYPE_FLASH */
+
+/* NVM offset of the sequence number ring */
+static uint16 seq_ring_offset;
+
+/* Index of the next sequence number record to write */
+static uint16 seq_ring_next;
+
+/* First sequence number not covered by the last record written */
+static uint32 seq_reserved;
+
+/* Device ETag last written to NVM */
+static CSR_MESH_ETAG_T nvm_device_etag;
+
+/* Association data kept from the 1.1 NVM layout. It only moves if
+ * NVM_BACKWARD_COMPATIBILITY is not defined, otherwise this version keeps the
+ * 1.1 offsets.
+ */
+static const NVM_FIELD_MOVE_T nvm_fields_1_1[] =
+{
+    {NVM_1_1_OFFSET_NETWORK_KEY,       NVM_OFFSET_NETWORK_KEY,
+                                       sizeof(CSR_MESH_NETWORK_KEY_T)},
+    {NVM_1_1_OFFSET_DEVICE_ID,         NVM_OFFSET_DEVICE_ID,        1},
+    {NVM_1_1_OFFSET_SEQUENCE_NUMBER,   NVM_OFFSET_SEQUENCE_NUMBER,  2},
+    {NVM_1_1_OFFSET_DEVICE_ETAG,       NVM_OFFSET_DEVICE_ETAG,
+                                       sizeof(CSR_MESH_ETAG_T)},
+    {NVM_1_1_OFFSET_ASSOCIATION_STATE, NVM_OFFSET_ASSOCIATION_STATE, 1},
+};
+
+/* Migrations of the earlier NVM layouts, one step each, from the oldest
+ * layout. Each step leads to the layout of the next entry, and the last one
+ * to this version. A layout is migrated through all the steps from its own.
+ * The NVM data of a layout not listed here is discarded, unless only its
+ * Application NVM version differs, in which case the association data is
+ * kept in place.
+ */
+static const NVM_MIGRATION_T nvm_migrations[] =
+{
+    {NVM_SANITY_MAGIC_1_1, APP_NVM_VERSION_1_1,
+                           nvm_fields_1_1, TABLE_SIZE(nvm_fields_1_1),
+                           NVM_NEW_ALL},
+
+    /* The sequence number ring was added past the version 4 data, every
+     * field of version 4 is in place.
+     */
+    {NVM_SANITY_MAGIC,     APP_NVM_VERSION_4,  NULL, 0, NVM_NEW_SEQ_RING},
+};
+
+/* Counters of the device ETag persistence */
+static ETAG_STATS_T etag_stats;
+
+#ifdef ENABLE_MESH_EVENT_STATS
+/* Processing time statistics of the CSRmesh events, indexed by event code */
+static MESH_EVENT_STATS_T mesh_event_stats[MESH_EVENT_TABLE_SIZE];
+#endif /* ENABLE_MESH_EVENT_STATS */
+
 /*============================================================================*
  *  Private Function Prototypes
  *============================================================================*/
@@ -319,9 +551,22 @@ static void handlePIOEvent(pio_changed_data *data);
 /* Advert time out handler */
 static void deviceIdAdvertTimeoutHandler(timer_id tid);
 
+/* This function drives the light as stored on NVM at boot. */
+static bool restoreLightState(void);
+
+/* This function migrates the persistent store from an earlier layout. */
+static bool migratePersistentStore(uint16 sanity, uint16 version,
+                                   uint16 *p_new_data);
+
 /* This function reads the persistent store. */
 static void readPersistentStore(void);
 
+/* This function recovers the sequence number from the NVM ring. */
+static uint32 readSeqRing(void);
+
+/* This function stores the sequence number in the NVM ring. */
+static void writeSeqRing(uint32 seq_number);
+
 /*============================================================================*
  *  Private Function Definitions
  *============================================================================*/
@@ -381,6 +626,9 @@ static void issueOTAReset(timer_id tid)
     {
         ota_rst_tid = TIMER_INVALID;
 
+        /* Write any pending NVM data before the reset */
+        Nvm_Flush();
+
         /* Issue OTA Reset. */
         OtaReset();
     }
@@ -444,32 +692,27 @@ static void deviceIdAdvertTimeoutHandler(timer_id tid)
  *      Nothing
  *
  *----------------------------------------------------------------------------*/
-static void lightDataNVMWriteTimerHandler(timer_id tid)
+static void lightDataNVMWriteTimerHandler(void)
 {
     uint32 rd_data = 0;
     uint32 wr_data = 0;
 
-    if (tid == g_lightapp_data.nvm_tid)
-    {
-        g_lightapp_data.nvm_tid = TIMER_INVALID;
-
-        /* Read RGB and Power Data from NVM */
-        Nvm_Read((uint16 *)&rd_data, sizeof(uint32),
-                 NVM_RGB_DATA_OFFSET);
+    /* Read RGB and Power Data from NVM */
+    Nvm_Read((uint16 *)&rd_data, sizeof(uint32),
+             NVM_RGB_DATA_OFFSET);
 
-        /* Pack Data for writing to NVM */
-        wr_data = ((uint32) g_lightapp_data.power.power_state << 24) |
-                  ((uint32) g_lightapp_data.light_state.blue  << 16) |
-                  ((uint32) g_lightapp_data.light_state.green <<  8) |
-                  g_lightapp_data.light_state.red;
+    /* Pack Data for writing to NVM */
+    wr_data = ((uint32) g_lightapp_data.power.power_state << 24) |
+              ((uint32) g_lightapp_data.light_state.blue  << 16) |
+              ((uint32) g_lightapp_data.light_state.green <<  8) |
+              g_lightapp_data.light_state.red;
 
-        /* If data on NVM is not equal to current state, write current state
-         * to NVM.
-         */
-        if (rd_data != wr_data)
-        {
-            Nvm_Write((uint16 *)&wr_data, sizeof(uint32),NVM_RGB_DATA_OFFSET);
-        }
+    /* If data on NVM is not equal to current state, write current state
+     * to NVM.
+     */
+    if (rd_data != wr_data)
+    {
+        Nvm_Write((uint16 *)&wr_data, sizeof(uint32),NVM_RGB_DATA_OFFSET);
     }
 }
 
@@ -670,78 +913,72 @@ void handlePIOEvent(pio_changed_data *data)
  *      Nothing.
  *
  *---------------------------------------------------------------------------*/
-static void requestConnParamUpdate(timer_id tid)
+static void requestConnParamUpdate(void)
 {
     /* Application specific preferred parameters */
     ble_con_params app_pref_conn_param;
 
-    if(g_lightapp_data.gatt_data.con_param_update_tid == tid)
-    {
+    g_lightapp_data.gatt_data.cpu_timer_value = 0;
 
-        g_lightapp_data.gatt_data.con_param_update_tid = TIMER_INVALID;
-        g_lightapp_data.gatt_data.cpu_timer_value = 0;
+    /*Handling signal as per current state */
+    switch(g_lightapp_data.state)
+    {
 
-        /*Handling signal as per current state */
-        switch(g_lightapp_data.state)
+        case app_state_connected:
         {
+            /* Increment the count for Connection Parameter Update
+             * requests
+             */
+            ++ g_lightapp_data.gatt_data.num_conn_update_req;
 
-            case app_state_connected:
+            /* If it is first or second request, preferred connection
+             * parameters should be request
+             */
+            if(g_lightapp_data.gatt_data.num_conn_update_req == 1 ||
+               g_lightapp_data.gatt_data.num_conn_update_req == 2)
             {
-                /* Increment the count for Connection Parameter Update
-                 * requests
-                 */
-                ++ g_lightapp_data.gatt_data.num_conn_update_req;
-
-                /* If it is first or second request, preferred connection
-                 * parameters should be request
-                 */
-                if(g_lightapp_data.gatt_data.num_conn_update_req == 1 ||
-                   g_lightapp_data.gatt_data.num_conn_update_req == 2)
-                {
-                    app_pref_conn_param.con_max_interval =
-                                                PREFERRED_MAX_CON_INTERVAL;
-                    app_pref_conn_param.con_min_interval =
-                                                PREFERRED_MIN_CON_INTERVAL;
-                    app_pref_conn_param.con_slave_latency =
-                                                PREFERRED_SLAVE_LATENCY;
-                    app_pref_conn_param.con_super_timeout =
-                                                PREFERRED_SUPERVISION_TIMEOUT;
-                }
-                /* If it is 3rd or 4th request, APPLE compliant parameters
-                 * should be requested.
-                 */
-                else if(g_lightapp_data.gatt_data.num_conn_update_req == 3 ||
-                        g_lightapp_data.gatt_data.num_conn_update_req == 4)
-                {
-                    app_pref_conn_param.con_max_interval =
-                                                APPLE_MAX_CON_INTERVAL;
-                    app_pref_conn_param.con_min_interval =
-                                                APPLE_MIN_CON_INTERVAL;
-                    app_pref_conn_param.con_slave_latency =
-                                                APPLE_SLAVE_LATENCY;
-                    app_pref_conn_param.con_super_timeout =
-                                                APPLE_SUPERVISION_TIMEOUT;
-                }
+                app_pref_conn_param.con_max_interval =
+                                            PREFERRED_MAX_CON_INTERVAL;
+                app_pref_conn_param.con_min_interval =
+                                            PREFERRED_MIN_CON_INTERVAL;
+                app_pref_conn_param.con_slave_latency =
+                                            PREFERRED_SLAVE_LATENCY;
+                app_pref_conn_param.con_super_timeout =
+                                            PREFERRED_SUPERVISION_TIMEOUT;
+            }
+            /* If it is 3rd or 4th request, APPLE compliant parameters
+             * should be requested.
+             */
+            else if(g_lightapp_data.gatt_data.num_conn_update_req == 3 ||
+                    g_lightapp_data.gatt_data.num_conn_update_req == 4)
+            {
+                app_pref_conn_param.con_max_interval =
+                                            APPLE_MAX_CON_INTERVAL;
+                app_pref_conn_param.con_min_interval =
+                                            APPLE_MIN_CON_INTERVAL;
+                app_pref_conn_param.con_slave_latency =
+                                            APPLE_SLAVE_LATENCY;
+                app_pref_conn_param.con_super_timeout =
+                                            APPLE_SUPERVISION_TIMEOUT;
+            }
 
-                /* Send Connection Parameter Update request using application
-                 * specific preferred connection parameters
-                 */
+            /* Send Connection Parameter Update request using application
+             * specific preferred connection parameters
+             */
 
-                if(LsConnectionParamUpdateReq(
-                                 &g_lightapp_data.gatt_data.con_bd_addr,
-                                 &app_pref_conn_param) != ls_err_none)
-                {
-                    ReportPanic(app_panic_con_param_update);
-                }
+            if(LsConnectionParamUpdateReq(
+                             &g_lightapp_data.gatt_data.con_bd_addr,
+                             &app_pref_conn_param) != ls_err_none)
+            {
+                ReportPanic(app_panic_con_param_update);
             }
-            break;
-
-            default:
-                /* Ignore in other states */
-            break;
         }
+        break;
 
-    } /* Else ignore the timer */
+        default:
+            /* Ignore in other states */
+        break;
+    }
 
 }
 
@@ -759,15 +996,11 @@ static void requestConnParamUpdate(timer_id tid)
  *      Nothing.
  *
  *----------------------------------------------------------------------------*/
-static void handleGapCppTimerExpiry(timer_id tid)
+static void handleGapCppTimerExpiry(void)
 {
-    if(g_lightapp_data.gatt_data.con_param_update_tid == tid)
-    {
-        g_lightapp_data.gatt_data.con_param_update_tid =
-                           TimerCreate(TGAP_CPC_PERIOD, TRUE,
-                                       requestConnParamUpdate);
-        g_lightapp_data.gatt_data.cpu_timer_value = TGAP_CPC_PERIOD;
-    }
+    SoftTimerStart(&g_lightapp_data.gatt_data.con_param_update_timer,
+                   TGAP_CPC_PERIOD, requestConnParamUpdate);
+    g_lightapp_data.gatt_data.cpu_timer_value = TGAP_CPC_PERIOD;
 }
 
 /*----------------------------------------------------------------------------*
@@ -788,8 +1021,7 @@ static void appDataInit(void)
     TimerDelete(g_lightapp_data.gatt_data.app_tid);
     g_lightapp_data.gatt_data.app_tid = TIMER_INVALID;
 
-    TimerDelete(g_lightapp_data.gatt_data.con_param_update_tid);
-    g_lightapp_data.gatt_data.con_param_update_tid = TIMER_INVALID;
+    SoftTimerStop(&g_lightapp_data.gatt_data.con_param_update_timer);
     g_lightapp_data.gatt_data.cpu_timer_value = 0;
 
     g_lightapp_data.gatt_data.st_ucid = GATT_INVALID_UCID;
@@ -817,126 +1049,315 @@ static void appDataInit(void)
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      readPersistentStore
+ *      restoreLightState
  *
  *  DESCRIPTION
- *      This function is used to Initialise and read NVM data
+ *      This function drives the light with the colour and power stored on
+ *      NVM, as early as possible at boot so the light comes back without
+ *      waiting for the CSRmesh and GATT initialisation. Only the NVM header,
+ *      the association state and the RGB and power word are read.
  *
- *  RETURNS/MODIFIES
- *      Nothing.
+ *  RETURNS
+ *      TRUE if the light was restored, FALSE if the NVM holds no light state
+ *      of an associated device in the current layout.
  *
  *----------------------------------------------------------------------------*/
-static void readPersistentStore(void)
+static bool restoreLightState(void)
 {
-    /* NVM offset for supported services */
-    uint16 nvm_offset = 0;
-    uint16 nvm_sanity = 0xffff;
-    uint16 app_nvm_version = 0;
-    uint32 temp = 0;
+    uint16 nvm_header[2];
+    app_association_state assoc_state;
+    uint32 rgb_data;
+    uint8  power_state;
+
+    Nvm_Read(nvm_header, 2, NVM_OFFSET_SANITY_WORD);
+    Nvm_Read((uint16 *)&assoc_state, sizeof(assoc_state),
+             NVM_OFFSET_ASSOCIATION_STATE);
+
+    if(nvm_header[0] != NVM_SANITY_MAGIC ||
+       nvm_header[NVM_OFFSET_APP_NVM_VERSION - NVM_OFFSET_SANITY_WORD] !=
+                                                            APP_NVM_VERSION ||
+       assoc_state != app_state_associated)
+    {
+        return FALSE;
+    }
 
-    nvm_offset = NVM_MAX_APP_MEMORY_WORDS;
+    /* RGB Data and Power are stored in the following format.
+     * HIGH WORD: MSB: POWER LSB: BLUE.
+     * LOW  WORD: MSB: GREEN LSB: RED.
+     */
+    Nvm_Read((uint16 *)&rgb_data, sizeof(uint32), NVM_RGB_DATA_OFFSET);
+    power_state = (rgb_data >> 24) & 0xFF;
 
-    /* Read the sanity word */
-    Nvm_Read(&nvm_sanity, sizeof(nvm_sanity),
-             NVM_OFFSET_SANITY_WORD);
+    LightHardwareSetColor(rgb_data & 0xFF, (rgb_data >> 8) & 0xFF,
+                          (rgb_data >> 16) & 0xFF);
+    LightHardwarePowerControl((power_state == POWER_STATE_ON) ||
+                              (power_state == POWER_STATE_ON_FROM_STANDBY));
 
-    /* Read the Application NVM version */
-    Nvm_Read(&app_nvm_version, 1, NVM_OFFSET_APP_NVM_VERSION);
+    return TRUE;
+}
 
-    if(nvm_sanity == NVM_SANITY_MAGIC &&
-       app_nvm_version == APP_NVM_VERSION )
-    {
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      readSeqRing
+ *
+ *  DESCRIPTION
+ *      This function scans the sequence number ring for the highest valid
+ *      record and positions the ring to write the record after it next. If
+ *      the ring holds no valid record, the sequence number stored by the
+ *      earlier versions of the application is used.
+ *
+ *  RETURNS
+ *      Sequence number to restart from.
+ *
+ *----------------------------------------------------------------------------*/
+static uint32 readSeqRing(void)
+{
+    uint16 ring[SEQ_RING_SIZE_WORDS];
+    uint16 *record;
+    uint32 seq_number;
+    uint32 highest = 0;
+    bool   found = FALSE;
+    uint16 index;
 
-        g_lightapp_data.gatt_data.paired = FALSE;
+    seq_ring_next = 0;
 
-        /* Read RGB and Power Data from NVM */
-        Nvm_Read((uint16 *)&temp, sizeof(uint32), NVM_RGB_DATA_OFFSET);
+    /* Read the whole ring in one pass. It is served from the NVM shadow on
+     * SPI flash, and read from the NVM on EEPROM.
+     */
+    Nvm_Read(ring, SEQ_RING_SIZE_WORDS, seq_ring_offset);
 
-        /* Read assigned Group IDs for Light model from NVM */
-        Nvm_Read((uint16 *)light_model_groups, sizeof(light_model_groups),
-                                                 NVM_OFFSET_LIGHT_MODEL_GROUPS);
+    for (index = 0; index < SEQ_RING_RECORDS; index++)
+    {
+        record = &ring[index * SEQ_RING_RECORD_WORDS];
 
-        /* Read assigned Group IDs for Power model from NVM */
-        Nvm_Read((uint16 *)power_model_groups, sizeof(power_model_groups),
-                                                 NVM_OFFSET_POWER_MODEL_GROUPS);
+        if (record[2] != SEQ_RING_CHECK(record[0], record[1]))
+        {
+            continue;
+        }
 
-        /* Read assigned Group IDs for Attention model from NVM */
-        Nvm_Read((uint16 *)attention_model_groups, sizeof(attention_model_groups),
-                                            NVM_OFFSET_ATTENTION_MODEL_GROUPS);
-#ifdef ENABLE_DATA_MODEL
-        /* Read assigned Group IDs for data stream model from NVM */
-        Nvm_Read((uint16 *)data_model_groups, sizeof(data_model_groups),
-                                            NVM_OFFSET_DATA_MODEL_GROUPS);
-#endif /* ENABLE_DATA_MODEL */
+        seq_number = ((uint32)record[1] << 16) | record[0];
+        if (!found || seq_number > highest)
+        {
+            highest = seq_number;
+            seq_ring_next = (index + 1) % SEQ_RING_RECORDS;
+            found = TRUE;
+        }
+    }
 
-        /* Unpack data in to the global variables */
-        g_lightapp_data.light_state.red   = temp & 0xFF;
-        temp >>= 8;
-        g_lightapp_data.light_state.green = temp & 0xFF;
-        temp >>= 8;
-        g_lightapp_data.light_state.blue  = temp & 0xFF;
-        temp >>= 8;
-        g_lightapp_data.power.power_state = temp & 0xFF;
-        g_lightapp_data.light_state.power = g_lightapp_data.power.power_state;
+    if (!found)
+    {
+        Nvm_Read((uint16 *)&highest, 2, NVM_OFFSET_SEQUENCE_NUMBER);
+    }
 
-        /* Read Bearer Model Data from NVM */
-        Nvm_Read((uint16 *)&g_lightapp_data.bearer_data,
-                 sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
+    seq_reserved = highest;
 
-        /* If NVM in use, read device name and length from NVM */
-        GapReadDataFromNVM(&nvm_offset);
-    }
-    else
+    return highest;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      writeSeqRing
+ *
+ *  DESCRIPTION
+ *      This function stores the sequence number in the next record of the
+ *      ring, unless it is still covered by the last reservation. The record
+ *      holds the end of a new reservation, so the sequence numbers used
+ *      until the next write are never reused after a reset.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+static void writeSeqRing(uint32 seq_number)
+{
+    uint16 record[SEQ_RING_RECORD_WORDS];
+
+    if (seq_number < seq_reserved)
     {
-        /* Read Configuration flags from User CS Key */
-        uint16 cskey_flags = CSReadUserKey(CSKEY_INDEX_USER_FLAGS);
+        return;
+    }
 
-        /* If the NVM_SANITY word the APP_NVM_VERSION matches the 1.1 version
-         * retain the association data on the NVM and update to newer versions.
-         */
-        if(nvm_sanity == NVM_SANITY_MAGIC_1_1 && 
-            app_nvm_version == APP_NVM_VERSION_1_1)
-        {
-            nvm_sanity = NVM_SANITY_MAGIC;
+    seq_reserved = seq_number + SEQ_RESERVE_AHEAD;
 
-            /* Write NVM Sanity word to the NVM */
-            Nvm_Write(&nvm_sanity, sizeof(nvm_sanity), NVM_OFFSET_SANITY_WORD);
-        }
-        
-        if( nvm_sanity != NVM_SANITY_MAGIC)
+    record[0] = (uint16)(seq_reserved & 0xFFFF);
+    record[1] = (uint16)(seq_reserved >> 16);
+    record[2] = SEQ_RING_CHECK(record[0], record[1]);
+
+    /* The record must survive a reset. Beyond the shadow it is written to
+     * the NVM straight away, in the shadow it has to be committed.
+     */
+    Nvm_Write(record, SEQ_RING_RECORD_WORDS,
+              seq_ring_offset + (seq_ring_next * SEQ_RING_RECORD_WORDS));
+#ifdef NVM_TYPE_FLASH
+    Nvm_Flush();
+#endif /* NVM_TYPE_FLASH */
+
+    seq_ring_next = (seq_ring_next + 1) % SEQ_RING_RECORDS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      migratePersistentStore
+ *
+ *  DESCRIPTION
+ *      This function looks up the NVM layout with the given sanity word and
+ *      Application NVM version in the migration table, and applies the steps
+ *      from it in turn, each moving the fields it keeps to their offsets in
+ *      the next layout. The fields only move to lower or equal offsets, so
+ *      copying the words in increasing order never overwrites a word still
+ *      to be moved. All the words are moved in the NVM shadow, so the whole
+ *      migration is committed with one NVM commit. The NVM_NEW_x data of
+ *      all the steps applied is returned in *p_new_data.
+ *
+ *  RETURNS
+ *      TRUE if the layout was migrated, FALSE if it is not in the table.
+ *
+ *----------------------------------------------------------------------------*/
+static bool migratePersistentStore(uint16 sanity, uint16 version,
+                                   uint16 *p_new_data)
+{
+    const NVM_MIGRATION_T *p_migration;
+    const NVM_FIELD_MOVE_T *p_field;
+    uint16 index;
+    uint16 field;
+    uint16 word;
+    uint16 value;
+
+    for(index = 0; index < TABLE_SIZE(nvm_migrations); index++)
+    {
+        p_migration = &nvm_migrations[index];
+        if(p_migration->sanity == sanity && p_migration->version == version)
         {
-            uint8 i;
+            break;
+        }
+    }
 
-            /* NVM Sanity check failed means either the device is being brought
-             * up for the first time or memory has got corrupted in which case
-             * discard the data and start fresh.
-             */
-            nvm_sanity = NVM_SANITY_MAGIC;
+    if(index == TABLE_SIZE(nvm_migrations))
+    {
+        return FALSE;
+    }
 
-            /* Write NVM Sanity word to the NVM */
-            Nvm_Write(&nvm_sanity, sizeof(nvm_sanity),
-                      NVM_OFFSET_SANITY_WORD);
+    /* Step through the later layouts up to this version */
+    for(; index < TABLE_SIZE(nvm_migrations); index++)
+    {
+        p_migration = &nvm_migrations[index];
+        *p_new_data |= p_migration->new_data;
 
-            if (cskey_flags & RANDOM_UUID_ENABLE_MASK)
+        for(field = 0; field < p_migration->num_fields; field++)
+        {
+            p_field = &p_migration->p_fields[field];
+            if(p_field->from_offset == p_field->to_offset)
             {
-                /* The flag is set so generate a random UUID and store it on NVM */
-                for( i = 0 ; i < DEVICE_UUID_SIZE_WORDS ; i++)
-                {
-                    g_node_data.device_uuid.uuid[i] = Random16();
-                }
-                /* Write to NVM */
-                Nvm_Write(g_node_data.device_uuid.uuid, DEVICE_UUID_SIZE_WORDS,
-                          NVM_OFFSET_DEVICE_UUID);
+                continue;
             }
-            else
+
+            for(word = 0; word < p_field->length; word++)
             {
-                /* A mass production tool may be used to program the device
-                 * firmware as well as the device UUID and authorisation code
-                 * in which case the NVM sanity check fails but the NVM will
-                 * have a valid UUID and Authorisation code.
-                 * So write the default UUID and AC only if all the words of the
-                 *
-                 */
+                Nvm_Read(&value, 1, p_field->from_offset + word);
+                Nvm_Write(&value, 1, p_field->to_offset + word);
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      readPersistentStore
+ *
+ *  DESCRIPTION
+ *      This function is used to Initialise and read NVM data
+ *
+ *  RETURNS/MODIFIES
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+static void readPersistentStore(void)
+{
+    /* NVM offset for supported services */
+    uint16 nvm_offset = 0;
+    uint16 nvm_header[2];
+    uint16 nvm_sanity = 0xffff;
+    uint16 app_nvm_version = 0;
+    uint32 temp = 0;
+    uint32 seq_number;
+    uint16 new_data = 0;
+
+    /* Read Configuration flags from User CS Key */
+    uint16 cskey_flags = CSReadUserKey(CSKEY_INDEX_USER_FLAGS);
+
+    nvm_offset = NVM_MAX_APP_MEMORY_WORDS;
+
+    /* Read the application data and the GAP service data into RAM in one
+     * pass. All the reads below are then served and validated from RAM.
+     */
+    Nvm_Load();
+
+    /* Read the sanity word and the Application NVM version */
+    Nvm_Read(nvm_header, 2, NVM_OFFSET_SANITY_WORD);
+    nvm_sanity = nvm_header[0];
+    app_nvm_version = nvm_header[NVM_OFFSET_APP_NVM_VERSION -
+                                 NVM_OFFSET_SANITY_WORD];
+
+    /* If the NVM holds this layout, all the data below is read from it */
+    if(nvm_sanity != NVM_SANITY_MAGIC ||
+       app_nvm_version != APP_NVM_VERSION )
+    {
+        /* If the NVM_SANITY word and the APP_NVM_VERSION match an earlier
+         * layout in the migration table, retain the data the migration steps
+         * keep and update to newer versions. Only the data a step adds or
+         * moves without keeping it is reset below.
+         */
+        if(migratePersistentStore(nvm_sanity, app_nvm_version, &new_data))
+        {
+            nvm_sanity = NVM_SANITY_MAGIC;
+
+            /* Write NVM Sanity word to the NVM */
+            Nvm_Write(&nvm_sanity, sizeof(nvm_sanity), NVM_OFFSET_SANITY_WORD);
+        }
+        else
+        {
+            /* All the persistent data below will be reset to default upon an
+             * application update of a layout not in the migration table.
+             */
+            new_data = NVM_NEW_ALL;
+        }
+
+        if( nvm_sanity != NVM_SANITY_MAGIC)
+        {
+            uint8 i;
+
+            /* NVM Sanity check failed means either the device is being brought
+             * up for the first time or memory has got corrupted in which case
+             * discard the data and start fresh.
+             */
+            nvm_sanity = NVM_SANITY_MAGIC;
+
+            /* Write NVM Sanity word to the NVM */
+            Nvm_Write(&nvm_sanity, sizeof(nvm_sanity),
+                      NVM_OFFSET_SANITY_WORD);
+
+            if (cskey_flags & RANDOM_UUID_ENABLE_MASK)
+            {
+                /* The flag is set so generate a random UUID and store it on NVM */
+                for( i = 0 ; i < DEVICE_UUID_SIZE_WORDS ; i++)
+                {
+                    g_node_data.device_uuid.uuid[i] = Random16();
+                }
+                /* Write to NVM */
+                Nvm_Write(g_node_data.device_uuid.uuid, DEVICE_UUID_SIZE_WORDS,
+                          NVM_OFFSET_DEVICE_UUID);
+            }
+            else
+            {
+                /* A mass production tool may be used to program the device
+                 * firmware as well as the device UUID and authorisation code
+                 * in which case the NVM sanity check fails but the NVM will
+                 * have a valid UUID and Authorisation code.
+                 * So write the default UUID and AC only if all the words of the
+                 *
+                 */
                 uint16 temp_word;
                 for( i = 0; i < DEVICE_UUID_SIZE_WORDS ; i++)
                 {
@@ -992,13 +1413,13 @@ static void readPersistentStore(void)
         /* Store new version of the NVM */
         app_nvm_version = APP_NVM_VERSION;
         Nvm_Write(&app_nvm_version, 1, NVM_OFFSET_APP_NVM_VERSION);
+    }
 
-        /* All the persistent data below will be reset to default upon an
-         * application update. If some of the data needs to be retained even
-         * after an application update, it has to be moved within the sanity
-         * word check
-         */
+    /* The device will not be paired as it is coming up */
+    g_lightapp_data.gatt_data.paired = FALSE;
 
+    if(new_data & NVM_NEW_BEARER_DATA)
+    {
         /* Update Bearer Model Data from CSKey flags for the first time. */
         g_lightapp_data.bearer_data.bearerPromiscuous = 0x0000;
         g_lightapp_data.bearer_data.bearerEnabled     = BLE_BEARER_MASK;
@@ -1023,12 +1444,16 @@ static void readPersistentStore(void)
         /* Update Bearer Model Data to NVM */
         Nvm_Write((uint16 *)&g_lightapp_data.bearer_data,
                   sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
+    }
+    else
+    {
+        /* Read Bearer Model Data from NVM */
+        Nvm_Read((uint16 *)&g_lightapp_data.bearer_data,
+                 sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
+    }
 
-        /* The device will not be paired as it is coming up for the first
-         * time
-         */
-        g_lightapp_data.gatt_data.paired = FALSE;
-
+    if(new_data & NVM_NEW_LIGHT_STATE)
+    {
         /* Write RGB Data and Power to NVM.
          * Data is stored in the following format.
          * HIGH WORD: MSB: POWER LSB: BLUE.
@@ -1047,7 +1472,25 @@ static void readPersistentStore(void)
 
         Nvm_Write((uint16 *)&temp, sizeof(uint32),
                  NVM_RGB_DATA_OFFSET);
+    }
+    else
+    {
+        /* Read RGB and Power Data from NVM */
+        Nvm_Read((uint16 *)&temp, sizeof(uint32), NVM_RGB_DATA_OFFSET);
+
+        /* Unpack data in to the global variables */
+        g_lightapp_data.light_state.red   = temp & 0xFF;
+        temp >>= 8;
+        g_lightapp_data.light_state.green = temp & 0xFF;
+        temp >>= 8;
+        g_lightapp_data.light_state.blue  = temp & 0xFF;
+        temp >>= 8;
+        g_lightapp_data.power.power_state = temp & 0xFF;
+        g_lightapp_data.light_state.power = g_lightapp_data.power.power_state;
+    }
 
+    if(new_data & NVM_NEW_MODEL_GROUPS)
+    {
         /* Initialise model groups */
         MemSet(light_model_groups, 0x0000, sizeof(light_model_groups));
         Nvm_Write((uint16 *)light_model_groups, sizeof(light_model_groups),
@@ -1067,9 +1510,60 @@ static void readPersistentStore(void)
         Nvm_Write((uint16 *)data_model_groups, sizeof(data_model_groups),
                                         NVM_OFFSET_DATA_MODEL_GROUPS);
 #endif /* ENABLE_DATA_MODEL */
+    }
+    else
+    {
+        /* Read assigned Group IDs for Light model from NVM */
+        Nvm_Read((uint16 *)light_model_groups, sizeof(light_model_groups),
+                                                 NVM_OFFSET_LIGHT_MODEL_GROUPS);
+
+        /* Read assigned Group IDs for Power model from NVM */
+        Nvm_Read((uint16 *)power_model_groups, sizeof(power_model_groups),
+                                                 NVM_OFFSET_POWER_MODEL_GROUPS);
+
+        /* Read assigned Group IDs for Attention model from NVM */
+        Nvm_Read((uint16 *)attention_model_groups, sizeof(attention_model_groups),
+                                            NVM_OFFSET_ATTENTION_MODEL_GROUPS);
+#ifdef ENABLE_DATA_MODEL
+        /* Read assigned Group IDs for data stream model from NVM */
+        Nvm_Read((uint16 *)data_model_groups, sizeof(data_model_groups),
+                                            NVM_OFFSET_DATA_MODEL_GROUPS);
+#endif /* ENABLE_DATA_MODEL */
+    }
+
+    if(new_data & NVM_NEW_GAP_DATA)
+    {
         /* Write device name and length to NVM for the first time */
         GapInitWriteDataToNVM(&nvm_offset);
     }
+    else
+    {
+        /* If NVM in use, read device name and length from NVM */
+        GapReadDataFromNVM(&nvm_offset);
+    }
+
+#ifdef NVM_TYPE_FLASH
+    /* The sequence number ring follows the GAP service data */
+    seq_ring_offset = nvm_offset;
+    nvm_offset += SEQ_RING_SIZE_WORDS;
+#else
+    seq_ring_offset = NVM_SEQ_RING_OFFSET;
+#endif /* NVM_TYPE_FLASH */
+
+    /* If the sequence number ring is not part of the earlier layout, discard
+     * whatever is stored where it goes. The sequence number then restarts
+     * from the one that layout stored.
+     */
+    if(new_data & NVM_NEW_SEQ_RING)
+    {
+        uint16 erased_ring[SEQ_RING_SIZE_WORDS];
+
+        MemSet(erased_ring, NVM_DEFAULT_ERASED_WORD, SEQ_RING_SIZE_WORDS);
+        Nvm_Write(erased_ring, SEQ_RING_SIZE_WORDS, seq_ring_offset);
+    }
+
+    /* Position the ring for the next write even if not associated */
+    seq_number = readSeqRing();
 
     /* Read association state from NVM */
     Nvm_Read((uint16 *)&g_lightapp_data.assoc_state,
@@ -1079,6 +1573,10 @@ static void readPersistentStore(void)
     Nvm_Read(g_node_data.device_uuid.uuid, DEVICE_UUID_SIZE_WORDS, 
                                                         NVM_OFFSET_DEVICE_UUID);
 
+    /* Read the device ETag on NVM, new ETags are compared against it */
+    Nvm_Read(nvm_device_etag.ETag, sizeof(CSR_MESH_ETAG_T),
+                                                    NVM_OFFSET_DEVICE_ETAG);
+
 #ifdef USE_AUTHORIZATION_CODE
     /* Read Authorization Code from NVM */
     Nvm_Read(g_node_data.auth_code.auth_code, DEVICE_AUTHCODE_SIZE_IN_WORDS,
@@ -1096,10 +1594,10 @@ static void readPersistentStore(void)
         /* Device ID */
         Nvm_Read(&g_node_data.device_id, 1, NVM_OFFSET_DEVICE_ID);
         /* Sequence Number */
-        Nvm_Read((uint16 *)&g_node_data.seq_number, 2, NVM_OFFSET_SEQUENCE_NUMBER);
+        g_node_data.seq_number = seq_number;
         /* Last ETag */
-        Nvm_Read(g_node_data.device_ETag.ETag, sizeof(CSR_MESH_ETAG_T),
-                                                    NVM_OFFSET_DEVICE_ETAG);
+        MemCopy(&g_node_data.device_ETag, &nvm_device_etag,
+                sizeof(CSR_MESH_ETAG_T));
         /* As device is already associated set LE bearer to non-promiscuous.*/
         g_lightapp_data.bearer_data.bearerPromiscuous &= ~BLE_BEARER_MASK;
     }
@@ -1341,8 +1839,8 @@ static void handleSignalGattConnectCfm(GATT_CONNECT_CFM_T* p_event_data)
                  * parameters and the timer is not running and, start timer
                  * to trigger Connection Parameter Update procedure
                  */
-                if((g_lightapp_data.gatt_data.con_param_update_tid ==
-                                                        TIMER_INVALID) &&
+                if(!SoftTimerRunning(
+                        &g_lightapp_data.gatt_data.con_param_update_timer) &&
                    (g_lightapp_data.gatt_data.conn_interval <
                                              PREFERRED_MIN_CON_INTERVAL ||
                     g_lightapp_data.gatt_data.conn_interval >
@@ -1372,9 +1870,9 @@ static void handleSignalGattConnectCfm(GATT_CONNECT_CFM_T* p_event_data)
                      * is complete and it initiates the connection parameter
                      * update procedure.
                      */
-                    g_lightapp_data.gatt_data.con_param_update_tid =
-                                      TimerCreate(TGAP_CPP_PERIOD, TRUE,
-                                                  handleGapCppTimerExpiry);
+                    SoftTimerStart(
+                            &g_lightapp_data.gatt_data.con_param_update_timer,
+                            TGAP_CPP_PERIOD, handleGapCppTimerExpiry);
                     g_lightapp_data.gatt_data.cpu_timer_value =
                                                         TGAP_CPP_PERIOD;
                 }
@@ -1477,12 +1975,9 @@ static void handleSignalLsConnParamUpdateCfm(
                 (g_lightapp_data.gatt_data.num_conn_update_req <
                                         MAX_NUM_CONN_PARAM_UPDATE_REQS))
             {
-                /* Delete timer if running */
-                TimerDelete(g_lightapp_data.gatt_data.con_param_update_tid);
-
-                g_lightapp_data.gatt_data.con_param_update_tid =
-                                 TimerCreate(GAP_CONN_PARAM_TIMEOUT,
-                                             TRUE, requestConnParamUpdate);
+                /* Restart the timer */
+                SoftTimerStart(&g_lightapp_data.gatt_data.con_param_update_timer,
+                               GAP_CONN_PARAM_TIMEOUT, requestConnParamUpdate);
                 g_lightapp_data.gatt_data.cpu_timer_value =
                                              GAP_CONN_PARAM_TIMEOUT;
             }
@@ -1569,9 +2064,8 @@ static void handleSignalLsConnParamUpdateInd(
     {
         case app_state_connected:
         {
-            /* Delete timer if running */
-            TimerDelete(g_lightapp_data.gatt_data.con_param_update_tid);
-            g_lightapp_data.gatt_data.con_param_update_tid = TIMER_INVALID;
+            /* Stop timer if running */
+            SoftTimerStop(&g_lightapp_data.gatt_data.con_param_update_timer);
             g_lightapp_data.gatt_data.cpu_timer_value = 0;
 
             /* The application had already received the new connection
@@ -1597,9 +2091,8 @@ static void handleSignalLsConnParamUpdateInd(
                 /* Start timer to trigger Connection Parameter Update
                  * procedure
                  */
-                g_lightapp_data.gatt_data.con_param_update_tid =
-                                TimerCreate(GAP_CONN_PARAM_TIMEOUT,
-                                            TRUE, requestConnParamUpdate);
+                SoftTimerStart(&g_lightapp_data.gatt_data.con_param_update_timer,
+                               GAP_CONN_PARAM_TIMEOUT, requestConnParamUpdate);
                 g_lightapp_data.gatt_data.cpu_timer_value =
                                                         GAP_CONN_PARAM_TIMEOUT;
             }
@@ -1644,12 +2137,11 @@ static void handleSignalGattAccessInd(GATT_ACCESS_IND_T *p_event_data)
              * timer
              */
              if(g_lightapp_data.gatt_data.cpu_timer_value == TGAP_CPC_PERIOD &&
-                g_lightapp_data.gatt_data.con_param_update_tid != TIMER_INVALID)
+                SoftTimerRunning(
+                        &g_lightapp_data.gatt_data.con_param_update_timer))
              {
-                TimerDelete(g_lightapp_data.gatt_data.con_param_update_tid);
-                g_lightapp_data.gatt_data.con_param_update_tid =
-                                    TimerCreate(TGAP_CPC_PERIOD,
-                                                TRUE, requestConnParamUpdate);
+                SoftTimerStart(&g_lightapp_data.gatt_data.con_param_update_timer,
+                               TGAP_CPC_PERIOD, requestConnParamUpdate);
              }
 
             /* Received GATT ACCESS IND with write access */
@@ -1733,6 +2225,8 @@ static void handleSignalLmDisconnectComplete(
 #ifdef ENABLE_GATT_OTA_SERVICE
     if(OtaResetRequired())
     {
+        /* Write any pending NVM data before the reset */
+        Nvm_Flush();
         OtaReset();
     }
 #endif /* ENABLE_GATT_OTA_SERVICE */
@@ -1771,6 +2265,73 @@ static void handleSignalLmDisconnectComplete(
     }
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      storeDeviceETag
+ *
+ *  DESCRIPTION
+ *      This function writes the device ETag to NVM, unless NVM already holds
+ *      the same ETag. The write is staged in the NVM shadow and committed
+ *      with the other pending NVM updates.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void storeDeviceETag(void)
+{
+    uint16 index;
+
+    for(index = 0; index < sizeof(CSR_MESH_ETAG_T); index++)
+    {
+        if(g_node_data.device_ETag.ETag[index] != nvm_device_etag.ETag[index])
+        {
+            break;
+        }
+    }
+
+    if(index == sizeof(CSR_MESH_ETAG_T))
+    {
+        etag_stats.avoided++;
+        return;
+    }
+
+    MemCopy(&nvm_device_etag, &g_node_data.device_ETag,
+            sizeof(CSR_MESH_ETAG_T));
+    Nvm_Write(nvm_device_etag.ETag, sizeof(CSR_MESH_ETAG_T),
+                                                    NVM_OFFSET_DEVICE_ETAG);
+    etag_stats.writes++;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      storeModelGroup
+ *
+ *  DESCRIPTION
+ *      This function stores a group ID at the given index of the groups of a
+ *      model, unless the model already has it. The NVM write is staged in
+ *      the NVM shadow, so all the group changes of a commissioning burst are
+ *      committed together once the NVM has been quiet for the flush window.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void storeModelGroup(uint16 *groups, uint8 index, uint16 group_id,
+                            uint16 nvm_offset)
+{
+    if(groups[index] == group_id)
+    {
+        /* Unchanged, nothing to write */
+        return;
+    }
+
+    groups[index] = group_id;
+
+    /* Save to NVM */
+    Nvm_Write(&groups[index], sizeof(uint16), nvm_offset + index);
+}
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      handleCsrMeshGroupSetMsg
@@ -1798,555 +2359,492 @@ static bool handleCsrMeshGroupSetMsg(uint8 *msg, uint16 len)
 
     if(model == CSR_MESH_LIGHT_MODEL || model == CSR_MESH_ALL_MODELS)
     {
-        /* Store Group ID */
-        light_model_groups[index] = group_id;
-
-        /* Save to NVM */
-        Nvm_Write(&light_model_groups[index],
-                 sizeof(uint16),
-                 NVM_OFFSET_LIGHT_MODEL_GROUPS + index);
+        storeModelGroup(light_model_groups, index, group_id,
+                        NVM_OFFSET_LIGHT_MODEL_GROUPS);
     }
 
     if(model == CSR_MESH_POWER_MODEL || model == CSR_MESH_ALL_MODELS)
     {
-        power_model_groups[index] = group_id;
-
-        /* Save to NVM */
-        Nvm_Write(&power_model_groups[index],
-                 sizeof(uint16),
-                 NVM_OFFSET_POWER_MODEL_GROUPS + index);
+        storeModelGroup(power_model_groups, index, group_id,
+                        NVM_OFFSET_POWER_MODEL_GROUPS);
     }
 
     if(model == CSR_MESH_ATTENTION_MODEL || model == CSR_MESH_ALL_MODELS)
     {
-        attention_model_groups[index] = group_id;
-
-        /* Save to NVM */
-        Nvm_Write(&attention_model_groups[index],
-                 sizeof(uint16),
-                 NVM_OFFSET_ATTENTION_MODEL_GROUPS + index);
+        storeModelGroup(attention_model_groups, index, group_id,
+                        NVM_OFFSET_ATTENTION_MODEL_GROUPS);
     }
 
 #ifdef ENABLE_DATA_MODEL
     if(model == CSR_MESH_DATA_MODEL || model == CSR_MESH_ALL_MODELS)
     {
-        data_model_groups[index] = group_id;
-
-        /* Save to NVM */
-        Nvm_Write(&data_model_groups[index],
-                 sizeof(uint16),
-                 NVM_OFFSET_DATA_MODEL_GROUPS + index);
+        storeModelGroup(data_model_groups, index, group_id,
+                        NVM_OFFSET_DATA_MODEL_GROUPS);
     }
 #endif /* ENABLE_DATA_MODEL */
 
     return update_lastetag;
 }
 
-/*============================================================================*
- *  Public Function Definitions
- *============================================================================*/
-#ifdef NVM_TYPE_FLASH
 /*----------------------------------------------------------------------------*
  *  NAME
- *      WriteApplicationAndServiceDataToNVM
+ *      handleAssociationRequest
  *
  *  DESCRIPTION
- *      This function writes the application data to NVM. This function should
- *      be called on getting nvm_status_needs_erase
+ *      This function handles the CSR_MESH_ASSOCIATION_REQUEST event.
  *
  *  RETURNS
- *      Nothing.
+ *      TRUE, the event having no flagged actions.
  *
  *---------------------------------------------------------------------------*/
-extern void WriteApplicationAndServiceDataToNVM(void)
+static bool handleAssociationRequest(csr_mesh_event_t event_code, uint8 *data,
+                                     uint16 length, void **state_data)
 {
-    uint16 nvm_sanity = 0xffff;
-    nvm_sanity = NVM_SANITY_MAGIC;
-
-    /* Write NVM sanity word to the NVM */
-    Nvm_Write(&nvm_sanity, sizeof(nvm_sanity), NVM_OFFSET_SANITY_WORD);
+    if( g_lightapp_data.assoc_state != app_state_association_started)
+    {
+        g_lightapp_data.assoc_state = app_state_association_started;
+    }
+    TimerDelete(g_lightapp_data.mesh_device_id_advert_tid);
+    g_lightapp_data.mesh_device_id_advert_tid = TIMER_INVALID;
 
-    /* Store the Association State */
-    Nvm_Write((uint16 *)&g_lightapp_data.assoc_state,
-             sizeof(g_lightapp_data.assoc_state),
-              NVM_OFFSET_ASSOCIATION_STATE);
+    /* Blink Light in Yellow to indicate association started */
+    LightHardwareSetBlink(127, 127, 0, 32, 32);
 
-    /* Write GAP service data into NVM */
-    WriteGapServiceDataInNVM();
+    return TRUE;
 }
-#endif /* NVM_TYPE_FLASH */
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      AppSetState
+ *      handleKeyDistribution
  *
  *  DESCRIPTION
- *      This function is used to set the state of the application.
+ *      This function handles the CSR_MESH_KEY_DISTRIBUTION event, which
+ *      completes the association.
  *
  *  RETURNS
- *      Nothing.
+ *      TRUE, the event having no flagged actions.
  *
  *---------------------------------------------------------------------------*/
-extern void AppSetState(app_state new_state)
+static bool handleKeyDistribution(csr_mesh_event_t event_code, uint8 *data,
+                                  uint16 length, void **state_data)
 {
-    /* Check if the new state to be set is not the same as the present state
-     * of the application.
-     */
-    app_state old_state = g_lightapp_data.state;
-
-    if (old_state != new_state)
-    {
-        /* Handle exiting old state */
-        switch (old_state)
-        {
-            case app_state_init:
-            break;
+    DEBUG_STR("Association complete\r\n");
+    g_lightapp_data.assoc_state = app_state_associated;
 
-            case app_state_disconnecting:
-                /* Initialise CSRmesh light data and services
-                 * data structure while exiting Disconnecting state.
-                 */
-                appDataInit();
-            break;
+    /* Write association state to NVM */
+    Nvm_Write((uint16 *)&g_lightapp_data.assoc_state, 1,
+                                          NVM_OFFSET_ASSOCIATION_STATE);
 
-            case app_state_advertising:
-                /* Common things to do whenever application exits advertising
-                 * state.
-                 */
-                appAdvertisingExit();
-            break;
+    /* Save the network key on NVM */
+    Nvm_Write((uint16 *)data, sizeof(CSR_MESH_NETWORK_KEY_T), 
+                                                NVM_OFFSET_NETWORK_KEY);
 
-            case app_state_connected:
-                /* Do nothing here */
-            break;
+    /* The association is complete set LE bearer to non-promiscuous.*/
+    g_lightapp_data.bearer_data.bearerPromiscuous &= ~BLE_BEARER_MASK;
+    CsrMeshEnablePromiscuousMode(
+                        g_lightapp_data.bearer_data.bearerPromiscuous);
 
-            default:
-                /* Nothing to do */
-            break;
-        }
+    /* Update Bearer Model Data to NVM */
+    Nvm_Write((uint16 *)&g_lightapp_data.bearer_data,
+              sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
 
-        /* Set new state */
-        g_lightapp_data.state = new_state;
+    /* Restore light settings after association */
+    LightHardwareSetColor(g_lightapp_data.light_state.red,
+                          g_lightapp_data.light_state.green,
+                          g_lightapp_data.light_state.blue);
 
-        /* Handle entering new state */
-        switch (new_state)
-        {
-            case app_state_advertising:
-            {
-                GattTriggerFastAdverts();
-            }
-            break;
+    /* Restore power settings after association */
+    LightHardwarePowerControl(g_lightapp_data.power.power_state);
 
-            case app_state_connected:
-            {
-                DEBUG_STR("Connected\r\n");
-            }
-            break;
+    /* The association must survive a reset, write it straight away */
+    Nvm_Flush();
 
-            case app_state_disconnecting:
-                GattDisconnectReq(g_lightapp_data.gatt_data.st_ucid);
-            break;
-
-            default:
-            break;
-        }
-    }
+    return TRUE;
 }
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      ReportPanic
+ *      handleAssociationAttention
  *
  *  DESCRIPTION
- *      This function calls firmware panic routine and gives a single point
- *      of debugging any application level panics
+ *      This function handles the CSR_MESH_ASSOCIATION_ATTENTION event.
  *
  *  RETURNS
- *      Nothing.
+ *      TRUE, the event having no flagged actions.
  *
  *---------------------------------------------------------------------------*/
-extern void ReportPanic(app_panic_code panic_code)
+static bool handleAssociationAttention(csr_mesh_event_t event_code,
+                                       uint8 *data, uint16 length,
+                                       void **state_data)
 {
-    /* Raise panic */
-    Panic(panic_code);
+    CSR_MESH_ASSOCIATION_ATTENTION_DATA_T *attn_data;
+
+    attn_data = (CSR_MESH_ASSOCIATION_ATTENTION_DATA_T *)data;
+
+    /* Delete attention timer if it exists */
+    if (TIMER_INVALID != attn_tid)
+    {
+        TimerDelete(attn_tid);
+        attn_tid = TIMER_INVALID;
+    }
+    /* If attention Enabled */
+    if (attn_data->attract_attention)
+    {
+        /* Create attention duration timer if required */
+        if(attn_data->duration != 0xFFFF)
+        {
+            attn_tid = TimerCreate(attn_data->duration * MILLISECOND, 
+                                                TRUE, attnTimerHandler);
+        }
+        /* Enable Green light blinking to attract attention */
+        LightHardwareSetBlink(0, 127, 0, 16, 16);
+    }
+    else
+    {
+        if(g_lightapp_data.assoc_state == app_state_not_associated)
+        {
+            /* Blink blue to indicate not associated status */
+            LightHardwareSetBlink(0, 0, 127, 32, 32);
+        }
+        else
+        {
+            /* Restore Light State */
+            LightHardwareSetColor(g_lightapp_data.light_state.red,
+                                  g_lightapp_data.light_state.green,
+                                  g_lightapp_data.light_state.blue);
+
+            /* Restore the light Power State */
+            LightHardwarePowerControl(g_lightapp_data.power.power_state);
+        }
+    }
+
+    return TRUE;
 }
 
-/*-----------------------------------------------------------------------------*
+/*----------------------------------------------------------------------------*
  *  NAME
- *      AppPowerOnReset
+ *      handleUpdateMsgSeqNumber
  *
  *  DESCRIPTION
- *      This user application function is called just after a power-on reset
- *      (including after a firmware panic), or after a wakeup from Hibernate or
- *      Dormant sleep states.
- *
- *      At the time this function is called, the last sleep state is not yet
- *      known.
- *
- *      NOTE: this function should only contain code to be executed after a
- *      power-on reset or panic. Code that should also be executed after an
- *      HCI_RESET should instead be placed in the AppInit() function.
+ *      This function handles the CSR_MESH_UPDATE_MSG_SEQ_NUMBER event.
  *
  *  RETURNS
- *      Nothing.
+ *      TRUE, the event having no flagged actions.
  *
- *----------------------------------------------------------------------------*/
-void AppPowerOnReset(void)
+ *---------------------------------------------------------------------------*/
+static bool handleUpdateMsgSeqNumber(csr_mesh_event_t event_code, uint8 *data,
+                                     uint16 length, void **state_data)
 {
+    /* Sequence number has updated, store it in the NVM ring */
+    writeSeqRing(((uint32)((uint16 *)data)[1] << 16) |
+                 ((uint16 *)data)[0]);
+
+    return TRUE;
 }
 
-/*-----------------------------------------------------------------------------*
+/*----------------------------------------------------------------------------*
  *  NAME
- *      AppInit
+ *      handleConfigResetDevice
  *
  *  DESCRIPTION
- *      This user application function is called after a power-on reset
- *      (including after a firmware panic), after a wakeup from Hibernate or
- *      Dormant sleep states, or after an HCI Reset has been requested.
- *
- *      The last sleep state is provided to the application in the parameter.
- *
- *      NOTE: In the case of a power-on reset, this function is called
- *      after app_power_on_reset().
+ *      This function handles the CSR_MESH_CONFIG_RESET_DEVICE event, which
+ *      dissociates the device and starts the association again.
  *
  *  RETURNS
- *      Nothing.
+ *      TRUE, so that the light state is written to NVM.
  *
- *----------------------------------------------------------------------------*/
-void AppInit(sleep_state last_sleep_state)
+ *---------------------------------------------------------------------------*/
+static bool handleConfigResetDevice(csr_mesh_event_t event_code, uint8 *data,
+                                    uint16 length, void **state_data)
 {
-    uint16 gatt_db_length = 0;
-    uint16 *p_gatt_db_pointer = NULL;
-    bool light_poweron = FALSE;
-    CSR_MESH_ADVSCAN_PARAM_T adv_scan_param;
-
-#ifdef USE_STATIC_RANDOM_ADDRESS
-    /* Generate random address for the CSRmesh Device. */
-    generateStaticRandomAddress(&g_lightapp_data.random_bd_addr);
-
-    /* Set the Static Random Address of the device. */
-    GapSetRandomAddress(&g_lightapp_data.random_bd_addr);
-#endif /* USE_STATIC_RANDOM_ADDRESS */
-
-    /* Initialise the application timers */
-    TimerInit(MAX_APP_TIMERS, (void*)app_timers);
-    g_lightapp_data.nvm_tid = TIMER_INVALID;
-
-#ifdef DEBUG_ENABLE
-    /* Initialise UART and configure with
-     * default baud rate and port configuration.
-     */
-    DebugInit(UART_BUF_SIZE_BYTES_32, UartDataRxCallback, NULL);
-
-    /* UART Rx threshold is set to 1,
-     * so that every byte received will trigger the rx callback.
-     */
-    UartRead(1, 0);
-#endif /* DEBUG_ENABLE */
-
-    DEBUG_STR("\r\nLight Application\r\n");
-
-    /* Initialise GATT entity */
-    GattInit();
-
-    /* Install GATT Server support for the optional Write procedure
-     * This is mandatory only if control point characteristic is supported.
-     */
-    GattInstallServerWriteLongReliable();
-
-    /* Don't wakeup on UART RX line */
-    SleepWakeOnUartRX(FALSE);
-
-#ifdef NVM_TYPE_EEPROM
-    /* Configure the NVM manager to use I2C EEPROM for NVM store */
-    NvmConfigureI2cEeprom();
-#elif NVM_TYPE_FLASH
-    /* Configure the NVM Manager to use SPI flash for NVM store. */
-    NvmConfigureSpiFlash();
-#endif /* NVM_TYPE_EEPROM */
-
-    NvmDisable();
-    /* Initialise the GATT and GAP data.
-     * Needs to be done before readPersistentStore
-     */
-    appDataInit();
-
-    /* Read persistent storage.
-     * Call this before CsrMeshInit.
-     */
-    readPersistentStore();
-
-    /* Initialise the CSRmesh */
-    CsrMeshInit(&g_node_data);
-
-    /* Update Relay status on Light */
-    CsrMeshRelayEnable(g_lightapp_data.bearer_data.bearerRelayActive);
-
-    /* Update promiscuous status */
-    CsrMeshEnablePromiscuousMode(g_lightapp_data.bearer_data.bearerPromiscuous);
-
-    /* Enable Notifications for raw messages */
-    CsrMeshEnableRawMsgEvent(TRUE);
-
-    /* Initialise the light model */
-    LightModelInit(light_model_groups, MAX_MODEL_GROUPS);
-
-    /* Initialise the power model */
-    PowerModelInit(power_model_groups, MAX_MODEL_GROUPS);
+    DEBUG_STR("Reset Device\r\n");
 
-    /* Initialise Bearer Model */
-    BearerModelInit();
+    /* Move device to dissociated state */
+    g_lightapp_data.assoc_state = app_state_not_associated;
 
-#ifdef ENABLE_FIRMWARE_MODEL
-    /* Initialise Firmware Model */
-    FirmwareModelInit();
+    /* Write association state to NVM */
+    Nvm_Write((uint16 *)&g_lightapp_data.assoc_state,
+             sizeof(g_lightapp_data.assoc_state),
+             NVM_OFFSET_ASSOCIATION_STATE);
 
-    /* Set Firmware Version */
-    g_lightapp_data.fw_version.major_version = APP_MAJOR_VERSION;
-    g_lightapp_data.fw_version.minor_version = APP_MINOR_VERSION;
-#endif /* ENABLE_FIRMWARE_MODEL */
+    /* Reset the supported model groups and save it to NVM */
+    /* Light model */
+    MemSet(light_model_groups, 0x0000, sizeof(light_model_groups));
+    Nvm_Write((uint16 *)light_model_groups, sizeof(light_model_groups),
+                                         NVM_OFFSET_LIGHT_MODEL_GROUPS);
 
-    /* Initialise Attention Model */
-    AttentionModelInit(attention_model_groups, MAX_MODEL_GROUPS);
+    /* Power model */
+    MemSet(power_model_groups, 0x0000, sizeof(power_model_groups));
+    Nvm_Write((uint16 *)power_model_groups, sizeof(power_model_groups),
+                                         NVM_OFFSET_POWER_MODEL_GROUPS);
 
-#ifdef ENABLE_BATTERY_MODEL
-    BatteryModelInit();
-#endif /* ENABLE_BATTERY_MODEL */
+    /* Attention model */
+    MemSet(attention_model_groups, 0x0000, sizeof(attention_model_groups));
+    Nvm_Write((uint16 *)attention_model_groups, sizeof(attention_model_groups),
+                                    NVM_OFFSET_ATTENTION_MODEL_GROUPS);
 
 #ifdef ENABLE_DATA_MODEL
-    AppDataStreamInit(data_model_groups, MAX_MODEL_GROUPS);
+    /* Data stream model */
+    MemSet(data_model_groups, 0x0000, sizeof(data_model_groups));
+    Nvm_Write((uint16 *)data_model_groups, sizeof(data_model_groups),
+                                    NVM_OFFSET_DATA_MODEL_GROUPS);
 #endif /* ENABLE_DATA_MODEL */
 
-    /* Start CSRmesh */
-    CsrMeshStart();
-
-    /* Get the stored adv scan parameters */
-    CsrMeshGetAdvScanParam(&adv_scan_param);
-
-    /* Read the mesh advertising parameter setting from the CS User Keys */
-    adv_scan_param.advertising_interval =
-                                CSReadUserKey(CSKEY_INDEX_CSRMESH_ADV_INTERVAL);
-    adv_scan_param.advertising_time = 
-                                    CSReadUserKey(CSKEY_INDEX_CSRMESH_ADV_TIME);
-    CsrMeshSetAdvScanParam(&adv_scan_param);
-
-    /* Tell Security Manager module about the value it needs to Initialise it's
-     * diversifier to.
+    /* Reset Light State */
+    g_lightapp_data.light_state.red   = 0xFF;
+    g_lightapp_data.light_state.green = 0xFF;
+    g_lightapp_data.light_state.blue  = 0xFF;
+    g_lightapp_data.light_state.power = POWER_STATE_OFF;
+    g_lightapp_data.power.power_state = POWER_STATE_OFF;
+
+    /* Enable promiscuous mode on un-associated devices so that they 
+     * relay all the messages. This helps propagate messages(MCP) based 
+     * on the newly assigned network key as they will be relayed also by
+     * the devices not yet associated.
      */
-    SMInit(0);
-
-    /* Initialise CSRmesh light application State */
-    g_lightapp_data.state = app_state_init;
-
-    /* Initialise Light Hardware */
-    LightHardwareInit();
+    g_lightapp_data.bearer_data.bearerPromiscuous =
+                       (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
+    CsrMeshEnablePromiscuousMode(
+                        g_lightapp_data.bearer_data.bearerPromiscuous);
 
-#ifdef USE_ASSOCIATION_REMOVAL_KEY
-    IOTSwitchInit();
-#endif /* USE_ASSOCIATION_REMOVAL_KEY */
+    /* Update Bearer Model Data to NVM */
+    Nvm_Write((uint16 *)&g_lightapp_data.bearer_data,
+              sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
 
-    /* Start a timer which does device ID adverts till the time device
-     * is associated
+    /* Write the dissociated state in one go, the association state
+     * and model groups being adjacent on NVM.
      */
-    if(app_state_not_associated == g_lightapp_data.assoc_state)
-    {
-        initiateAssociation();
-    }
-    else
-    {
-        DEBUG_STR("Light is associated\r\n");
+    Nvm_Flush();
 
-        /* Light is already associated. Set the colour from NVM */
-        LightHardwareSetColor(g_lightapp_data.light_state.red,
-                              g_lightapp_data.light_state.green,
-                              g_lightapp_data.light_state.blue);
+    /* Start Mesh association again */
+    initiateAssociation();
 
+    return TRUE;
+}
 
-        /* Set the light power as read from NVM */
-        if ((g_lightapp_data.power.power_state == POWER_STATE_ON) ||
-            (g_lightapp_data.power.power_state == POWER_STATE_ON_FROM_STANDBY))
-        {
-            light_poweron = TRUE;
-        }
-        LightHardwarePowerControl(light_poweron);
-    }
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleConfigDeviceIdentifier
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_CONFIG_DEVICE_IDENTIFIER event.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleConfigDeviceIdentifier(csr_mesh_event_t event_code,
+                                         uint8 *data, uint16 length,
+                                         void **state_data)
+{
+    Nvm_Write((uint16 *)data, 1, NVM_OFFSET_DEVICE_ID);
+    TRACE(trace_device_id, data[0], 0);
 
-    /* Tell GATT about our database. We will get a GATT_ADD_DB_CFM event when
-     * this has completed.
-     */
-    p_gatt_db_pointer = GattGetDatabase(&gatt_db_length);
-    GattAddDatabaseReq(gatt_db_length, p_gatt_db_pointer);
+    return TRUE;
 }
 
-/*-----------------------------------------------------------------------------*
+/*----------------------------------------------------------------------------*
  *  NAME
- *      AppProcesSystemEvent
+ *      handleConfigGetVidPidVersion
  *
  *  DESCRIPTION
- *      This user application function is called whenever a system event, such
- *      as a battery low notification, is received by the system.
+ *      This function handles the CSR_MESH_CONFIG_GET_VID_PID_VERSION event.
  *
  *  RETURNS
- *      Nothing.
+ *      TRUE, the event having no flagged actions.
  *
- *----------------------------------------------------------------------------*/
-void AppProcessSystemEvent(sys_event_id id, void *data)
+ *---------------------------------------------------------------------------*/
+static bool handleConfigGetVidPidVersion(csr_mesh_event_t event_code,
+                                         uint8 *data, uint16 length,
+                                         void **state_data)
 {
-    DEBUG_STR("flag_AppProcessSystemEvent");
-    switch (id)
+    if (state_data != NULL)
     {
-        case sys_event_pio_changed:
-        {
-#ifdef USE_ASSOCIATION_REMOVAL_KEY
-            handlePIOEvent((pio_changed_data*)data);
-#endif
-        }
-        break;
-
-        default:
-        break;
+        *state_data = (void *)&vid_pid_info;
     }
+
+    return TRUE;
 }
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      AppProcessLmEvent
+ *      handleConfigGetAppearance
  *
  *  DESCRIPTION
- *      This user application function is called whenever a LM-specific event
- *      is received by the system.
+ *      This function handles the CSR_MESH_CONFIG_GET_APPEARANCE event.
  *
- * PARAMETERS
- *      event_code [in]   LM event ID
- *      event_data [in]   LM event data
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
  *
- * RETURNS
- *      TRUE if the application has finished with the event data;
- *           the control layer will free the buffer.
- *----------------------------------------------------------------------------*/
-extern bool AppProcessLmEvent(lm_event_code event_code,
-                              LM_EVENT_T *p_event_data)
+ *---------------------------------------------------------------------------*/
+static bool handleConfigGetAppearance(csr_mesh_event_t event_code,
+                                      uint8 *data, uint16 length,
+                                      void **state_data)
 {
-    DEBUG_STR("flag_AppProcessLmEvent\n");
-    switch(event_code)
+    if (state_data != NULL)
     {
-        /* Handle events received from Firmware */
+        *state_data = (void *)&device_appearance;
+    }
 
-        case GATT_ADD_DB_CFM:
-            /* Attribute database registration confirmation */
-            handleSignalGattAddDBCfm((GATT_ADD_DB_CFM_T*)p_event_data);
-        break;
+    return TRUE;
+}
 
-        case GATT_CANCEL_CONNECT_CFM:
-            /* Confirmation for the completion of GattCancelConnectReq()
-             * procedure
-             */
-            handleSignalGattCancelConnectCfm();
-        break;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleGroupSetModelGroupId
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_GROUP_SET_MODEL_GROUPID event.
+ *
+ *  RETURNS
+ *      TRUE if the group assignment changed and the ETag must be updated.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleGroupSetModelGroupId(csr_mesh_event_t event_code,
+                                       uint8 *data, uint16 length,
+                                       void **state_data)
+{
+    return handleCsrMeshGroupSetMsg(data, length);
+}
 
-        case LM_EV_CONNECTION_COMPLETE:
-            /* Handle the LM connection complete event. */
-            handleSignalLmEvConnectionComplete((LM_EV_CONNECTION_COMPLETE_T*)
-                                                                p_event_data);
-        break;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleLightSetLevel
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_LIGHT_SET_LEVEL event.
+ *
+ *  RETURNS
+ *      TRUE, so that the light state is written to NVM.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleLightSetLevel(csr_mesh_event_t event_code, uint8 *data,
+                                uint16 length, void **state_data)
+{
+    /* Update State of RGB in application */
+    g_lightapp_data.light_state.level = data[0];
+    g_lightapp_data.light_state.power = POWER_STATE_ON;
+    g_lightapp_data.power.power_state = POWER_STATE_ON;
+
+    /* Set the light level in the latest RGB setting */
+    LightHardwareSetLevel(g_lightapp_data.light_state.red, 
+                          g_lightapp_data.light_state.green,
+                          g_lightapp_data.light_state.blue,
+                          g_lightapp_data.light_state.level);
+
+    /* Send Light State Information to Model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.light_state;
+    }
 
-        case GATT_CONNECT_CFM:
-            /* Confirmation for the completion of GattConnectReq()
-             * procedure
-             */
-            handleSignalGattConnectCfm((GATT_CONNECT_CFM_T*)p_event_data);
-        break;
+    TRACE(trace_set_level, data[0], 0);
 
-        case SM_SIMPLE_PAIRING_COMPLETE_IND:
-            /* Indication for completion of Pairing procedure */
-            handleSignalSmSimplePairingCompleteInd(
-                (SM_SIMPLE_PAIRING_COMPLETE_IND_T*)p_event_data);
-        break;
+    return TRUE;
+}
 
-        case LM_EV_ENCRYPTION_CHANGE:
-            /* Indication for encryption change event */
-            /* Nothing to do */
-        break;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleLightSetRgb
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_LIGHT_SET_RGB event.
+ *
+ *  RETURNS
+ *      TRUE, so that the light state is written to NVM.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleLightSetRgb(csr_mesh_event_t event_code, uint8 *data,
+                              uint16 length, void **state_data)
+{
+    /* Update State of RGB in application */
+    g_lightapp_data.light_state.level = data[0];
+    g_lightapp_data.light_state.red   = data[1];
+    g_lightapp_data.light_state.green = data[2];
+    g_lightapp_data.light_state.blue  = data[3];
+    g_lightapp_data.light_state.power = POWER_STATE_ON;
+    g_lightapp_data.power.power_state = POWER_STATE_ON;
+
+    /* If the sender asked for a transition time, use it for this
+     * and the following colour and level changes.
+     */
+    if (length >= LIGHT_SET_RGB_DURATION_OFFSET + 2)
+    {
+        uint8 *pData = &data[LIGHT_SET_RGB_DURATION_OFFSET];
+        LightHardwareSetRampTime(BufReadUint16(&pData));
+    }
 
-        /* Received in response to the LsConnectionParamUpdateReq()
-         * request sent from the slave after encryption is enabled. If
-         * the request has failed, the device should again send the same
-         * request only after Tgap(conn_param_timeout). Refer Bluetooth 4.0
-         * spec Vol 3 Part C, Section 9.3.9 and HID over GATT profile spec
-         * section 5.1.2.
-         */
-        case LS_CONNECTION_PARAM_UPDATE_CFM:
-            handleSignalLsConnParamUpdateCfm(
-                (LS_CONNECTION_PARAM_UPDATE_CFM_T*) p_event_data);
-        break;
+    /* Set the light level in the latest RGB setting */
+    LightHardwareSetLevel(g_lightapp_data.light_state.red, 
+                          g_lightapp_data.light_state.green,
+                          g_lightapp_data.light_state.blue,
+                          g_lightapp_data.light_state.level);
 
-        case LM_EV_CONNECTION_UPDATE:
-            /* This event is sent by the controller on connection parameter
-             * update.
-             */
-            handleSignalLmConnectionUpdate(
-                            (LM_EV_CONNECTION_UPDATE_T*)p_event_data);
-        break;
+    /* Send Light State Information to Model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.light_state;
+    }
 
-        case LS_CONNECTION_PARAM_UPDATE_IND:
-            /* Indicates completion of remotely triggered Connection
-             * parameter update procedure
-             */
-            handleSignalLsConnParamUpdateInd(
-                            (LS_CONNECTION_PARAM_UPDATE_IND_T *)p_event_data);
-        break;
+    TRACE(trace_set_rgb, ((uint16)data[1] << 8) | data[2], data[3]);
 
-        case GATT_ACCESS_IND:
-            /* Indicates that an attribute controlled directly by the
-             * application (ATT_ATTR_IRQ attribute flag is set) is being
-             * read from or written to.
-             */
-            handleSignalGattAccessInd((GATT_ACCESS_IND_T*)p_event_data);
-        break;
+    return TRUE;
+}
 
-        case GATT_DISCONNECT_IND:
-            /* Disconnect procedure triggered by remote host or due to
-             * link loss is considered complete on reception of
-             * LM_EV_DISCONNECT_COMPLETE event. So, it gets handled on
-             * reception of LM_EV_DISCONNECT_COMPLETE event.
-             */
-         break;
+#ifdef COLOUR_TEMP_ENABLED
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleLightSetColorTemp
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_LIGHT_SET_COLOR_TEMP event.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleLightSetColorTemp(csr_mesh_event_t event_code, uint8 *data,
+                                    uint16 length, void **state_data)
+{
+    g_lightapp_data.light_state.color_temp = 
+                                     ((uint16)data[1] << 8) | (data[0]);
 
-        case GATT_DISCONNECT_CFM:
-            /* Confirmation for the completion of GattDisconnectReq()
-             * procedure is ignored as the procedure is considered complete
-             * on reception of LM_EV_DISCONNECT_COMPLETE event. So, it gets
-             * handled on reception of LM_EV_DISCONNECT_COMPLETE event.
-             */
-        break;
+    g_lightapp_data.power.power_state = POWER_STATE_ON;
+    g_lightapp_data.light_state.power = POWER_STATE_ON;
 
-        case LM_EV_DISCONNECT_COMPLETE:
-        {
-            /* Disconnect procedures either triggered by application or remote
-             * host or link loss case are considered completed on reception
-             * of LM_EV_DISCONNECT_COMPLETE event
-             */
-             handleSignalLmDisconnectComplete(
-                    &((LM_EV_DISCONNECT_COMPLETE_T *)p_event_data)->data);
-        }
-        break;
+    /* Set Colour temperature of light */
+    LightHardwareSetColorTemp(g_lightapp_data.light_state.color_temp);
 
-        case LM_EV_ADVERTISING_REPORT:
-        {
-            CsrMeshProcessMessage((LM_EV_ADVERTISING_REPORT_T *)p_event_data);
-        }
-        break;
+    /* Send Light State Information to Model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.light_state;
+    }
 
-        case LS_RADIO_EVENT_IND:
-        {
-            CsrMeshHandleRadioEvent();
-        }
-        break;
+    TRACE(trace_set_colour_temp, g_lightapp_data.light_state.color_temp, 0);
 
-        default:
-            /* Ignore any other event */
-        break;
+    return TRUE;
+}
+#endif /* COLOUR_TEMP_ENABLED */
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleLightGetState
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_LIGHT_GET_STATE event.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleLightGetState(csr_mesh_event_t event_code, uint8 *data,
+                                uint16 length, void **state_data)
+{
+    /* Send Light State Information to Model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.light_state;
     }
 
     return TRUE;
@@ -2354,631 +2852,1174 @@ extern bool AppProcessLmEvent(lm_event_code event_code,
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      AppProcessCsrMeshEvent
+ *      handlePowerGetState
  *
  *  DESCRIPTION
- *      This user application function is called whenever a CSRmesh event
- *      is received by the system.
+ *      This function handles the CSR_MESH_POWER_GET_STATE event.
  *
- * PARAMETERS
- *      event_code csr_mesh_event_t
- *      data       Data associated with the event
- *      length     Length of the data
- *      state_data Pointer to the variable pointing to state data.
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
  *
- * RETURNS
- *      TRUE if the app has finished with the event data; the control layer
- *      will free the buffer.
- *----------------------------------------------------------------------------*/
-extern void AppProcessCsrMeshEvent(csr_mesh_event_t event_code, uint8* data,
-                                   uint16 length, void **state_data)
+ *---------------------------------------------------------------------------*/
+static bool handlePowerGetState(csr_mesh_event_t event_code, uint8 *data,
+                                uint16 length, void **state_data)
 {
-    bool start_nvm_timer = FALSE;
-    bool update_lastetag = FALSE;
-    DEBUG_STR("flag_AppProcessCsrMeshEvent\n");
-    switch(event_code)
+    /* Send Power State Information to Model */
+    if (state_data != NULL)
     {
-        case CSR_MESH_ASSOCIATION_REQUEST:
-        {
-            if( g_lightapp_data.assoc_state != app_state_association_started)
-            {
-                g_lightapp_data.assoc_state = app_state_association_started;
-            }
-            TimerDelete(g_lightapp_data.mesh_device_id_advert_tid);
-            g_lightapp_data.mesh_device_id_advert_tid = TIMER_INVALID;
+        *state_data = (void *)&g_lightapp_data.power;
+    }
 
-            /* Blink Light in Yellow to indicate association started */
-            LightHardwareSetBlink(127, 127, 0, 32, 32);
-        }
-        break;
+    return TRUE;
+}
 
-        case CSR_MESH_KEY_DISTRIBUTION:
-        {
-            DEBUG_STR("Association complete\r\n");
-            g_lightapp_data.assoc_state = app_state_associated;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handlePowerSetState
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_POWER_SET_STATE and
+ *      CSR_MESH_POWER_TOGGLE_STATE events.
+ *
+ *  RETURNS
+ *      TRUE, so that the light state is written to NVM.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handlePowerSetState(csr_mesh_event_t event_code, uint8 *data,
+                                uint16 length, void **state_data)
+{
+    if (CSR_MESH_POWER_SET_STATE == event_code)
+    {
+        g_lightapp_data.power.power_state = data[0];
+    }
+    else
+    {
+        togglePowerState();
+    }
 
-            /* Write association state to NVM */
-            Nvm_Write((uint16 *)&g_lightapp_data.assoc_state, 1,
-                                                  NVM_OFFSET_ASSOCIATION_STATE);
+    TRACE(trace_set_power, g_lightapp_data.power.power_state, 0);
 
-            /* Save the network key on NVM */
-            Nvm_Write((uint16 *)data, sizeof(CSR_MESH_NETWORK_KEY_T), 
-                                                        NVM_OFFSET_NETWORK_KEY);
+    if (g_lightapp_data.power.power_state == POWER_STATE_OFF ||
+        g_lightapp_data.power.power_state == POWER_STATE_STANDBY)
+    {
+        LightHardwarePowerControl(FALSE);
+    }
+    else if(g_lightapp_data.power.power_state == POWER_STATE_ON ||
+            g_lightapp_data.power.power_state == \
+                                        POWER_STATE_ON_FROM_STANDBY)
+    {
+        LightHardwareSetColor(g_lightapp_data.light_state.red,
+                              g_lightapp_data.light_state.green,
+                              g_lightapp_data.light_state.blue);
 
-            /* The association is complete set LE bearer to non-promiscuous.*/
-            g_lightapp_data.bearer_data.bearerPromiscuous &= ~BLE_BEARER_MASK;
-            CsrMeshEnablePromiscuousMode(
-                                g_lightapp_data.bearer_data.bearerPromiscuous);
+        /* Turn on with old colour value restored */
+        LightHardwarePowerControl(TRUE);
+    }
 
-            /* Update Bearer Model Data to NVM */
-            Nvm_Write((uint16 *)&g_lightapp_data.bearer_data,
-                      sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
+    g_lightapp_data.light_state.power =
+                                    g_lightapp_data.power.power_state;
 
-            /* Restore light settings after association */
-            LightHardwareSetColor(g_lightapp_data.light_state.red,
-                                  g_lightapp_data.light_state.green,
-                                  g_lightapp_data.light_state.blue);
+    /* Send Power State Information to Model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.power;
+    }
 
-            /* Restore power settings after association */
-            LightHardwarePowerControl(g_lightapp_data.power.power_state);
+    return TRUE;
+}
 
-        }
-        break;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleBearerGetState
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_BEARER_GET_STATE event.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleBearerGetState(csr_mesh_event_t event_code, uint8 *data,
+                                 uint16 length, void **state_data)
+{
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.bearer_data;
+    }
 
-        case CSR_MESH_ASSOCIATION_ATTENTION:
-        {
-            CSR_MESH_ASSOCIATION_ATTENTION_DATA_T *attn_data;
+    return TRUE;
+}
 
-            attn_data = (CSR_MESH_ASSOCIATION_ATTENTION_DATA_T *)data;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleBearerSetState
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_BEARER_SET_STATE event.
+ *
+ *  RETURNS
+ *      TRUE, so that the ETag is updated.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleBearerSetState(csr_mesh_event_t event_code, uint8 *data,
+                                 uint16 length, void **state_data)
+{
+    uint8 *pData = data;
+    g_lightapp_data.bearer_data.bearerRelayActive = BufReadUint16(&pData);
+    g_lightapp_data.bearer_data.bearerEnabled     = BufReadUint16(&pData);
+    g_lightapp_data.bearer_data.bearerPromiscuous = BufReadUint16(&pData);
 
-            /* Delete attention timer if it exists */
-            if (TIMER_INVALID != attn_tid)
-            {
-                TimerDelete(attn_tid);
-                attn_tid = TIMER_INVALID;
-            }
-            /* If attention Enabled */
-            if (attn_data->attract_attention)
-            {
-                /* Create attention duration timer if required */
-                if(attn_data->duration != 0xFFFF)
-                {
-                    attn_tid = TimerCreate(attn_data->duration * MILLISECOND, 
-                                                        TRUE, attnTimerHandler);
-                }
-                /* Enable Green light blinking to attract attention */
-                LightHardwareSetBlink(0, 127, 0, 16, 16);
-            }
-            else
-            {
-                if(g_lightapp_data.assoc_state == app_state_not_associated)
-                {
-                    /* Blink blue to indicate not associated status */
-                    LightHardwareSetBlink(0, 0, 127, 32, 32);
-                }
-                else
-                {
-                    /* Restore Light State */
-                    LightHardwareSetColor(g_lightapp_data.light_state.red,
-                                          g_lightapp_data.light_state.green,
-                                          g_lightapp_data.light_state.blue);
+    /* BLE Advert Bearer is always enabled on this device. */
+    g_lightapp_data.bearer_data.bearerEnabled    |= BLE_BEARER_MASK;
 
-                    /* Restore the light Power State */
-                    LightHardwarePowerControl(g_lightapp_data.power.power_state);
-                }
-            }
-        }
-        break;
+    /* Filter the supported bearers from the bitmap received */
+    g_lightapp_data.bearer_data.bearerRelayActive = 
+        g_lightapp_data.bearer_data.bearerRelayActive & 
+            (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
+
+    /* Filter the supported bearers from the bitmap received */
+    g_lightapp_data.bearer_data.bearerEnabled = 
+        g_lightapp_data.bearer_data.bearerEnabled & 
+            (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
+
+    g_lightapp_data.bearer_data.bearerPromiscuous = 
+        g_lightapp_data.bearer_data.bearerPromiscuous & 
+            (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
+
+    /* Update the saved values */
+    bearer_relay_active = g_lightapp_data.bearer_data.bearerRelayActive;
+    bearer_promiscuous = g_lightapp_data.bearer_data.bearerPromiscuous;
 
-        case CSR_MESH_UPDATE_MSG_SEQ_NUMBER:
+    /* Update new bearer state */
+    CsrMeshRelayEnable(g_lightapp_data.bearer_data.bearerRelayActive);
+    CsrMeshEnablePromiscuousMode(
+                     g_lightapp_data.bearer_data.bearerPromiscuous);
+
+    /* Update Bearer Model Data to NVM */
+    Nvm_Write((uint16 *)&g_lightapp_data.bearer_data,
+             sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
+
+    if(g_lightapp_data.state != app_state_connected) 
+    {
+        if(g_lightapp_data.bearer_data.bearerEnabled 
+                                        & BLE_GATT_SERVER_BEARER_MASK)
         {
-            /* Sequence number has updated, store it in NVM */
-            Nvm_Write((uint16 *)data, 2, NVM_OFFSET_SEQUENCE_NUMBER);
+            AppSetState(app_state_advertising);
         }
-        break;
-
-        case CSR_MESH_CONFIG_RESET_DEVICE:
+        else
         {
-            DEBUG_STR("Reset Device\r\n");
+            AppSetState(app_state_idle);
+        }
+    }
 
-            /* Move device to dissociated state */
-            g_lightapp_data.assoc_state = app_state_not_associated;
+    /* Send the new bearer state to the model */
+    return handleBearerGetState(event_code, data, length, state_data);
+}
 
-            /* Write association state to NVM */
-            Nvm_Write((uint16 *)&g_lightapp_data.assoc_state,
-                     sizeof(g_lightapp_data.assoc_state),
-                     NVM_OFFSET_ASSOCIATION_STATE);
-
-            /* Reset the supported model groups and save it to NVM */
-            /* Light model */
-            MemSet(light_model_groups, 0x0000, sizeof(light_model_groups));
-            Nvm_Write((uint16 *)light_model_groups, sizeof(light_model_groups),
-                                                 NVM_OFFSET_LIGHT_MODEL_GROUPS);
+#ifdef ENABLE_FIRMWARE_MODEL
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleFirmwareGetVersionInfo
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_FIRMWARE_GET_VERSION_INFO event.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleFirmwareGetVersionInfo(csr_mesh_event_t event_code,
+                                         uint8 *data, uint16 length,
+                                         void **state_data)
+{
+    /* Send Firmware Version data to the model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.fw_version;
+    }
 
-            /* Power model */
-            MemSet(power_model_groups, 0x0000, sizeof(power_model_groups));
-            Nvm_Write((uint16 *)power_model_groups, sizeof(power_model_groups),
-                                                 NVM_OFFSET_POWER_MODEL_GROUPS);
+    return TRUE;
+}
 
-            /* Attention model */
-            MemSet(attention_model_groups, 0x0000, sizeof(attention_model_groups));
-            Nvm_Write((uint16 *)attention_model_groups, sizeof(attention_model_groups),
-                                            NVM_OFFSET_ATTENTION_MODEL_GROUPS);
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleFirmwareUpdateRequired
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_FIRMWARE_UPDATE_REQUIRED event,
+ *      which resets the device in the OTA boot loader.
+ *
+ *  RETURNS
+ *      TRUE, so that the ETag is updated.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleFirmwareUpdateRequired(csr_mesh_event_t event_code,
+                                         uint8 *data, uint16 length,
+                                         void **state_data)
+{
+    BD_ADDR_T *pBDAddr = NULL;
+#ifdef USE_STATIC_RANDOM_ADDRESS
+    pBDAddr = &g_lightapp_data.random_bd_addr;
+#endif /* USE_STATIC_RANDOM_ADDRESS */
 
-#ifdef ENABLE_DATA_MODEL
-            /* Data stream model */
-            MemSet(data_model_groups, 0x0000, sizeof(data_model_groups));
-            Nvm_Write((uint16 *)data_model_groups, sizeof(data_model_groups),
-                                            NVM_OFFSET_DATA_MODEL_GROUPS);
-#endif /* ENABLE_DATA_MODEL */
+    DEBUG_STR("\r\n FIRMWARE UPDATE IN PROGRESS \r\n");
 
-            /* Reset Light State */
-            g_lightapp_data.light_state.red   = 0xFF;
-            g_lightapp_data.light_state.green = 0xFF;
-            g_lightapp_data.light_state.blue  = 0xFF;
-            g_lightapp_data.light_state.power = POWER_STATE_OFF;
-            g_lightapp_data.power.power_state = POWER_STATE_OFF;
-            start_nvm_timer = TRUE;
+    /* Write the value CSR_OTA_BOOT_LOADER to NVM so that
+     * it starts in OTA mode upon reset
+     */
+    OtaWriteCurrentApp(csr_ota_boot_loader,
+                       FALSE,   /* is bonded */
+                       NULL,    /* Typed host BD Address */
+                       0,       /* Diversifier */
+                       pBDAddr, /* local_random_address */
+                       NULL,    /* irk */
+                       FALSE    /* service_changed_config */
+                      );
+
+    /* Defer OTA Reset for half a second to ensure that,
+     * acknowledgements are sent before reset.
+     */
+    ota_rst_tid = TimerCreate(OTA_RESET_DEFER_DURATION, TRUE,
+                              issueOTAReset);
 
-            /* Enable promiscuous mode on un-associated devices so that they 
-             * relay all the messages. This helps propagate messages(MCP) based 
-             * on the newly assigned network key as they will be relayed also by
-             * the devices not yet associated.
-             */
-            g_lightapp_data.bearer_data.bearerPromiscuous =
-                               (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
-            CsrMeshEnablePromiscuousMode(
-                                g_lightapp_data.bearer_data.bearerPromiscuous);
+    return TRUE;
+}
+#endif /* ENABLE_FIRMWARE_MODEL */
 
-            /* Update Bearer Model Data to NVM */
-            Nvm_Write((uint16 *)&g_lightapp_data.bearer_data,
-                      sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
+#ifdef ENABLE_BATTERY_MODEL
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleBatteryGetState
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_BATTERY_GET_STATE event.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleBatteryGetState(csr_mesh_event_t event_code, uint8 *data,
+                                  uint16 length, void **state_data)
+{
+    /* Initialise battery state. IOT  boards (H13323) are battery powered */
+    g_lightapp_data.battery_data.battery_state = 
+                                    BATTERY_MODEL_STATE_POWERING_DEVICE;
+    /* Read Battery Level */
+    g_lightapp_data.battery_data.battery_level = ReadBatteryLevel();
 
-            /* Start Mesh association again */
-            initiateAssociation();
-        }
-        break;
+    if(g_lightapp_data.battery_data.battery_level == 0)
+    {
+        /* Voltage is below flat battery voltage. Set the needs 
+         * replacement flag in the battery state
+         */
+        g_lightapp_data.battery_data.battery_state |=
+                                  BATTERY_MODEL_STATE_NEEDS_REPLACEMENT;
+    }
+    /* Pass Battery state data to model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.battery_data;
+    }
 
-        case CSR_MESH_CONFIG_DEVICE_IDENTIFIER:
-        {
-            Nvm_Write((uint16 *)data, 1, NVM_OFFSET_DEVICE_ID);
-            DEBUG_STR("Device ID received:");
-            DEBUG_U16(((uint16)data[0]));
-            DEBUG_STR("\r\n");
-        }
-        break;
+    return TRUE;
+}
+#endif /* ENABLE_BATTERY_MODEL */
 
-        case CSR_MESH_CONFIG_GET_VID_PID_VERSION:
-        {
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&vid_pid_info;
-            }
-        }
-        break;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleAttentionSetState
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_ATTENTION_SET_STATE event.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleAttentionSetState(csr_mesh_event_t event_code, uint8 *data,
+                                    uint16 length, void **state_data)
+{
+    uint32 dur_us;
+    /* Read the data */
+    g_lightapp_data.attn_data.attract_attn  = BufReadUint8(&data);
+    g_lightapp_data.attn_data.attn_duration = BufReadUint16(&data);
 
-        case CSR_MESH_CONFIG_GET_APPEARANCE:
-        {
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&device_appearance;
-            }
-        }
-        break;
+    /* Delete attention timer if it exists */
+    if (TIMER_INVALID != attn_tid)
+    {
+        TimerDelete(attn_tid);
+        attn_tid = TIMER_INVALID;
+    }
 
-        case CSR_MESH_GROUP_SET_MODEL_GROUPID:
+    /* If attention Enabled */
+    if (g_lightapp_data.attn_data.attract_attn)
+    {
+        /* Create attention duration timer if required */
+        if (g_lightapp_data.attn_data.attn_duration != 0xFFFF)
         {
-            update_lastetag = handleCsrMeshGroupSetMsg(data, length);
+            dur_us = (uint32)g_lightapp_data.attn_data.attn_duration * \
+                             MILLISECOND;
+            attn_tid = TimerCreate(dur_us, TRUE, attnTimerHandler);
         }
-        break;
 
-        case CSR_MESH_LIGHT_SET_LEVEL:
-        {
-            /* Update State of RGB in application */
-            g_lightapp_data.light_state.level = data[0];
-            g_lightapp_data.light_state.power = POWER_STATE_ON;
-            g_lightapp_data.power.power_state = POWER_STATE_ON;
-            start_nvm_timer = TRUE;
+        /* Enable Red light blinking to attract attention */
+        LightHardwareSetBlink(127, 0, 0, 32, 32);
+    }
+    else
+    {
+        /* Restore Light State */
+        LightHardwareSetColor(g_lightapp_data.light_state.red,
+                              g_lightapp_data.light_state.green,
+                              g_lightapp_data.light_state.blue);
 
-            /* Set the light level in the latest RGB setting */
-            LightHardwareSetLevel(g_lightapp_data.light_state.red, 
-                                  g_lightapp_data.light_state.green,
-                                  g_lightapp_data.light_state.blue,
-                                  g_lightapp_data.light_state.level);
+        /* Restore the light Power State */
+        LightHardwarePowerControl(g_lightapp_data.power.power_state);
+    }
 
-            /* Send Light State Information to Model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.light_state;
-            }
+    /* Send response data to model */
+    if (state_data != NULL)
+    {
+        *state_data = (void *)&g_lightapp_data.attn_data;
+    }
 
-            /* Don't apply to hardware unless light is ON */
-            DEBUG_STR("Set Level: ");
-            DEBUG_U8(data[0]);
-            DEBUG_STR("\r\n");
-        }
+    /* Debug logs */
+    DEBUG_STR("\r\n ATTENTION_SET_STATE : Enable :");
+    DEBUG_U8(g_lightapp_data.attn_data.attract_attn);
+    DEBUG_STR("Duration : ");
+    DEBUG_U16(g_lightapp_data.attn_data.attn_duration);
+    DEBUG_STR("\r\n");
+
+    return TRUE;
+}
+
+#ifdef ENABLE_DATA_MODEL
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleDataStreamEvent
+ *
+ *  DESCRIPTION
+ *      This function passes the data stream model events to the application
+ *      data stream protocol.
+ *
+ *  RETURNS
+ *      TRUE, the events having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleDataStreamEvent(csr_mesh_event_t event_code, uint8 *data,
+                                  uint16 length, void **state_data)
+{
+    CSR_MESH_STREAM_EVENT_T *p_event = (CSR_MESH_STREAM_EVENT_T *)data;
+
+    switch(event_code)
+    {
+        case CSR_MESH_DATA_STREAM_SEND_CFM:
+            handleCSRmeshDataStreamSendCfm(p_event);
         break;
 
-        case CSR_MESH_LIGHT_SET_RGB:
-        {
-            /* Update State of RGB in application */
-            g_lightapp_data.light_state.level = data[0];
-            g_lightapp_data.light_state.red   = data[1];
-            g_lightapp_data.light_state.green = data[2];
-            g_lightapp_data.light_state.blue  = data[3];
-            g_lightapp_data.light_state.power = POWER_STATE_ON;
-            g_lightapp_data.power.power_state = POWER_STATE_ON;
-            start_nvm_timer = TRUE;
+        case CSR_MESH_DATA_STREAM_DATA_IND:
+            handleCSRmeshDataStreamDataInd(p_event);
+        break;
 
-            /* Set the light level in the latest RGB setting */
-            LightHardwareSetLevel(g_lightapp_data.light_state.red, 
-                                  g_lightapp_data.light_state.green,
-                                  g_lightapp_data.light_state.blue,
-                                  g_lightapp_data.light_state.level);
+        /* Stream flush indication */
+        case CSR_MESH_DATA_STREAM_FLUSH_IND:
+            handleCSRmeshDataStreamFlushInd(p_event);
+        break;
 
-            /* Send Light State Information to Model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.light_state;
-            }
+        /* Received a single block of data */
+        case CSR_MESH_DATA_BLOCK_IND:
+            handleCSRmeshDataBlockInd(p_event);
+        break;
 
-            DEBUG_STR("Set RGB : ");
-            DEBUG_U8(data[1]);
-            DEBUG_STR(",");
-            DEBUG_U8(data[2]);
-            DEBUG_STR(",");
-            DEBUG_U8(data[3]);
-            DEBUG_STR("\r\n");
-        }
+        default:
         break;
+    }
 
-        case CSR_MESH_LIGHT_SET_COLOR_TEMP:
-        {
-#ifdef COLOUR_TEMP_ENABLED
-            g_lightapp_data.light_state.color_temp = 
-                                             ((uint16)data[1] << 8) | (data[0]);
+    return TRUE;
+}
+#endif /* ENABLE_DATA_MODEL */
 
-            g_lightapp_data.power.power_state = POWER_STATE_ON;
-            g_lightapp_data.light_state.power = POWER_STATE_ON;
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      handleRawMessage
+ *
+ *  DESCRIPTION
+ *      This function handles the CSR_MESH_RAW_MESSAGE event, a raw message
+ *      received from the lower layers, by notifying it to the control device
+ *      if connected.
+ *
+ *  RETURNS
+ *      TRUE, the event having no flagged actions.
+ *
+ *---------------------------------------------------------------------------*/
+static bool handleRawMessage(csr_mesh_event_t event_code, uint8 *data,
+                             uint16 length, void **state_data)
+{
+    if (g_lightapp_data.state == app_state_connected)
+    {
+        MeshControlNotifyResponse(g_lightapp_data.gatt_data.st_ucid,
+                                  data, length);
+    }
 
-            /* Set Colour temperature of light */
-            LightHardwareSetColorTemp(g_lightapp_data.light_state.color_temp);
+    return TRUE;
+}
 
-            /* Send Light State Information to Model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.light_state;
-            }
+/* Handlers of the CSRmesh events, indexed by event code. Events without a
+ * handler are ignored. The flags select the actions taken once the handler
+ * returns TRUE.
+ */
+static const MESH_EVENT_ENTRY_T mesh_event_handlers[MESH_EVENT_TABLE_SIZE] =
+{
+    [CSR_MESH_ASSOCIATION_REQUEST] =
+        {handleAssociationRequest,     0},
+    [CSR_MESH_KEY_DISTRIBUTION] =
+        {handleKeyDistribution,        0},
+    [CSR_MESH_ASSOCIATION_ATTENTION] =
+        {handleAssociationAttention,   0},
+    [CSR_MESH_UPDATE_MSG_SEQ_NUMBER] =
+        {handleUpdateMsgSeqNumber,     0},
+    [CSR_MESH_CONFIG_RESET_DEVICE] =
+        {handleConfigResetDevice,      MESH_EVENT_WRITE_LIGHT_STATE},
+    [CSR_MESH_CONFIG_DEVICE_IDENTIFIER] =
+        {handleConfigDeviceIdentifier, 0},
+    [CSR_MESH_CONFIG_GET_VID_PID_VERSION] =
+        {handleConfigGetVidPidVersion, 0},
+    [CSR_MESH_CONFIG_GET_APPEARANCE] =
+        {handleConfigGetAppearance,    0},
+    [CSR_MESH_GROUP_SET_MODEL_GROUPID] =
+        {handleGroupSetModelGroupId,   MESH_EVENT_UPDATE_ETAG},
+    [CSR_MESH_LIGHT_SET_LEVEL] =
+        {handleLightSetLevel,          MESH_EVENT_WRITE_LIGHT_STATE},
+    [CSR_MESH_LIGHT_SET_RGB] =
+        {handleLightSetRgb,            MESH_EVENT_WRITE_LIGHT_STATE},
+#ifdef COLOUR_TEMP_ENABLED
+    [CSR_MESH_LIGHT_SET_COLOR_TEMP] =
+        {handleLightSetColorTemp,      0},
+#endif /* COLOUR_TEMP_ENABLED */
+    [CSR_MESH_LIGHT_GET_STATE] =
+        {handleLightGetState,          0},
+    [CSR_MESH_POWER_GET_STATE] =
+        {handlePowerGetState,          0},
+    [CSR_MESH_POWER_TOGGLE_STATE] =
+        {handlePowerSetState,          MESH_EVENT_WRITE_LIGHT_STATE},
+    [CSR_MESH_POWER_SET_STATE] =
+        {handlePowerSetState,          MESH_EVENT_WRITE_LIGHT_STATE},
+    [CSR_MESH_BEARER_SET_STATE] =
+        {handleBearerSetState,         MESH_EVENT_UPDATE_ETAG},
+    [CSR_MESH_BEARER_GET_STATE] =
+        {handleBearerGetState,         0},
+#ifdef ENABLE_FIRMWARE_MODEL
+    [CSR_MESH_FIRMWARE_GET_VERSION_INFO] =
+        {handleFirmwareGetVersionInfo, 0},
+    [CSR_MESH_FIRMWARE_UPDATE_REQUIRED] =
+        {handleFirmwareUpdateRequired, MESH_EVENT_UPDATE_ETAG},
+#endif /* ENABLE_FIRMWARE_MODEL */
+#ifdef ENABLE_BATTERY_MODEL
+    [CSR_MESH_BATTERY_GET_STATE] =
+        {handleBatteryGetState,        0},
+#endif /* ENABLE_BATTERY_MODEL */
+    [CSR_MESH_ATTENTION_SET_STATE] =
+        {handleAttentionSetState,      0},
+#ifdef ENABLE_DATA_MODEL
+    [CSR_MESH_DATA_STREAM_SEND_CFM] =
+        {handleDataStreamEvent,        0},
+    [CSR_MESH_DATA_STREAM_DATA_IND] =
+        {handleDataStreamEvent,        0},
+    [CSR_MESH_DATA_STREAM_FLUSH_IND] =
+        {handleDataStreamEvent,        0},
+    [CSR_MESH_DATA_BLOCK_IND] =
+        {handleDataStreamEvent,        0},
+#endif /* ENABLE_DATA_MODEL */
+    [CSR_MESH_RAW_MESSAGE] =
+        {handleRawMessage,             0},
+};
 
-            DEBUG_STR("Set Colour Temperature: ");
-            DEBUG_U16(g_lightapp_data.light_state.color_temp);
-            DEBUG_STR("\r\n");
+/* Every event code handled above must be below MESH_EVENT_TABLE_SIZE. The
+ * array size is negative, so the build fails, for any that is not.
+ */
+#define MESH_EVENT_CODE_CHECK(code) \
+    typedef char mesh_event_check_##code[((code) < MESH_EVENT_TABLE_SIZE) ? \
+                                         1 : -1]
+
+MESH_EVENT_CODE_CHECK(CSR_MESH_ASSOCIATION_REQUEST);
+MESH_EVENT_CODE_CHECK(CSR_MESH_KEY_DISTRIBUTION);
+MESH_EVENT_CODE_CHECK(CSR_MESH_ASSOCIATION_ATTENTION);
+MESH_EVENT_CODE_CHECK(CSR_MESH_UPDATE_MSG_SEQ_NUMBER);
+MESH_EVENT_CODE_CHECK(CSR_MESH_CONFIG_RESET_DEVICE);
+MESH_EVENT_CODE_CHECK(CSR_MESH_CONFIG_DEVICE_IDENTIFIER);
+MESH_EVENT_CODE_CHECK(CSR_MESH_CONFIG_GET_VID_PID_VERSION);
+MESH_EVENT_CODE_CHECK(CSR_MESH_CONFIG_GET_APPEARANCE);
+MESH_EVENT_CODE_CHECK(CSR_MESH_GROUP_SET_MODEL_GROUPID);
+MESH_EVENT_CODE_CHECK(CSR_MESH_LIGHT_SET_LEVEL);
+MESH_EVENT_CODE_CHECK(CSR_MESH_LIGHT_SET_RGB);
+#ifdef COLOUR_TEMP_ENABLED
+MESH_EVENT_CODE_CHECK(CSR_MESH_LIGHT_SET_COLOR_TEMP);
 #endif /* COLOUR_TEMP_ENABLED */
-        }
-        break;
+MESH_EVENT_CODE_CHECK(CSR_MESH_LIGHT_GET_STATE);
+MESH_EVENT_CODE_CHECK(CSR_MESH_POWER_GET_STATE);
+MESH_EVENT_CODE_CHECK(CSR_MESH_POWER_TOGGLE_STATE);
+MESH_EVENT_CODE_CHECK(CSR_MESH_POWER_SET_STATE);
+MESH_EVENT_CODE_CHECK(CSR_MESH_BEARER_SET_STATE);
+MESH_EVENT_CODE_CHECK(CSR_MESH_BEARER_GET_STATE);
+#ifdef ENABLE_FIRMWARE_MODEL
+MESH_EVENT_CODE_CHECK(CSR_MESH_FIRMWARE_GET_VERSION_INFO);
+MESH_EVENT_CODE_CHECK(CSR_MESH_FIRMWARE_UPDATE_REQUIRED);
+#endif /* ENABLE_FIRMWARE_MODEL */
+#ifdef ENABLE_BATTERY_MODEL
+MESH_EVENT_CODE_CHECK(CSR_MESH_BATTERY_GET_STATE);
+#endif /* ENABLE_BATTERY_MODEL */
+MESH_EVENT_CODE_CHECK(CSR_MESH_ATTENTION_SET_STATE);
+#ifdef ENABLE_DATA_MODEL
+MESH_EVENT_CODE_CHECK(CSR_MESH_DATA_STREAM_SEND_CFM);
+MESH_EVENT_CODE_CHECK(CSR_MESH_DATA_STREAM_DATA_IND);
+MESH_EVENT_CODE_CHECK(CSR_MESH_DATA_STREAM_FLUSH_IND);
+MESH_EVENT_CODE_CHECK(CSR_MESH_DATA_BLOCK_IND);
+#endif /* ENABLE_DATA_MODEL */
+MESH_EVENT_CODE_CHECK(CSR_MESH_RAW_MESSAGE);
 
-        case CSR_MESH_LIGHT_GET_STATE:
-        {
-            /* Send Light State Information to Model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.light_state;
-            }
-        }
-        break;
+#ifdef ENABLE_MESH_EVENT_STATS
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      recordMeshEventTime
+ *
+ *  DESCRIPTION
+ *      This function adds the time taken to process a CSRmesh event to the
+ *      statistics of its event code. The events the application ignores are
+ *      counted too, so that the statistics cover all the events below
+ *      MESH_EVENT_TABLE_SIZE.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void recordMeshEventTime(csr_mesh_event_t event_code, uint32 duration)
+{
+    MESH_EVENT_STATS_T *p_stats = &mesh_event_stats[event_code];
+    uint16 time = (duration > 0xFFFF) ? 0xFFFF : (uint16)duration;
 
-        case CSR_MESH_POWER_GET_STATE:
-        {
-            /* Send Power State Information to Model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.power;
-            }
-        }
-        break;
+    if(p_stats->count == 0 || time < p_stats->min_time)
+    {
+        p_stats->min_time = time;
+    }
+    if(time > p_stats->max_time)
+    {
+        p_stats->max_time = time;
+    }
+    p_stats->total_time += duration;
+    p_stats->count++;
+}
+#endif /* ENABLE_MESH_EVENT_STATS */
 
-        case CSR_MESH_POWER_TOGGLE_STATE:
-        case CSR_MESH_POWER_SET_STATE:
-        {
-            if (CSR_MESH_POWER_SET_STATE == event_code)
-            {
-                g_lightapp_data.power.power_state = data[0];
-            }
-            else
-            {
-                togglePowerState();
-            }
+/*============================================================================*
+ *  Public Function Definitions
+ *============================================================================*/
 
-            DEBUG_STR("Set Power: ");
-            DEBUG_U8(g_lightapp_data.power.power_state);
-            DEBUG_STR("\r\n");
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AppGetETagStats
+ *
+ *  DESCRIPTION
+ *      This function reads the counters of the device ETag persistence.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void AppGetETagStats(ETAG_STATS_T *p_stats)
+{
+    MemCopy(p_stats, &etag_stats, sizeof(ETAG_STATS_T));
+}
+
+#ifdef ENABLE_MESH_EVENT_STATS
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AppGetMeshEventStats
+ *
+ *  DESCRIPTION
+ *      This function reads the processing time statistics of a CSRmesh event
+ *      code, which must be below MESH_EVENT_TABLE_SIZE.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void AppGetMeshEventStats(csr_mesh_event_t event_code,
+                                 MESH_EVENT_STATS_T *p_stats)
+{
+    MemCopy(p_stats, &mesh_event_stats[event_code],
+            sizeof(MESH_EVENT_STATS_T));
+}
+#endif /* ENABLE_MESH_EVENT_STATS */
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AppSetState
+ *
+ *  DESCRIPTION
+ *      This function is used to set the state of the application.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void AppSetState(app_state new_state)
+{
+    /* Check if the new state to be set is not the same as the present state
+     * of the application.
+     */
+    app_state old_state = g_lightapp_data.state;
+
+    if (old_state != new_state)
+    {
+        /* Handle exiting old state */
+        switch (old_state)
+        {
+            case app_state_init:
+            break;
+
+            case app_state_disconnecting:
+                /* Initialise CSRmesh light data and services
+                 * data structure while exiting Disconnecting state.
+                 */
+                appDataInit();
+            break;
+
+            case app_state_advertising:
+                /* Common things to do whenever application exits advertising
+                 * state.
+                 */
+                appAdvertisingExit();
+            break;
+
+            case app_state_connected:
+                /* Do nothing here */
+            break;
+
+            default:
+                /* Nothing to do */
+            break;
+        }
+
+        /* Set new state */
+        g_lightapp_data.state = new_state;
 
-            if (g_lightapp_data.power.power_state == POWER_STATE_OFF ||
-                g_lightapp_data.power.power_state == POWER_STATE_STANDBY)
+        /* Handle entering new state */
+        switch (new_state)
+        {
+            case app_state_advertising:
             {
-                LightHardwarePowerControl(FALSE);
+                GattTriggerFastAdverts();
             }
-            else if(g_lightapp_data.power.power_state == POWER_STATE_ON ||
-                    g_lightapp_data.power.power_state == \
-                                                POWER_STATE_ON_FROM_STANDBY)
+            break;
+
+            case app_state_connected:
             {
-                LightHardwareSetColor(g_lightapp_data.light_state.red,
-                                      g_lightapp_data.light_state.green,
-                                      g_lightapp_data.light_state.blue);
+                DEBUG_STR("Connected\r\n");
+            }
+            break;
+
+            case app_state_disconnecting:
+                GattDisconnectReq(g_lightapp_data.gatt_data.st_ucid);
+            break;
+
+            default:
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ReportPanic
+ *
+ *  DESCRIPTION
+ *      This function calls firmware panic routine and gives a single point
+ *      of debugging any application level panics
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void ReportPanic(app_panic_code panic_code)
+{
+    /* Raise panic */
+    Panic(panic_code);
+}
+
+/*-----------------------------------------------------------------------------*
+ *  NAME
+ *      AppPowerOnReset
+ *
+ *  DESCRIPTION
+ *      This user application function is called just after a power-on reset
+ *      (including after a firmware panic), or after a wakeup from Hibernate or
+ *      Dormant sleep states.
+ *
+ *      At the time this function is called, the last sleep state is not yet
+ *      known.
+ *
+ *      NOTE: this function should only contain code to be executed after a
+ *      power-on reset or panic. Code that should also be executed after an
+ *      HCI_RESET should instead be placed in the AppInit() function.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+void AppPowerOnReset(void)
+{
+}
+
+/*-----------------------------------------------------------------------------*
+ *  NAME
+ *      AppInit
+ *
+ *  DESCRIPTION
+ *      This user application function is called after a power-on reset
+ *      (including after a firmware panic), after a wakeup from Hibernate or
+ *      Dormant sleep states, or after an HCI Reset has been requested.
+ *
+ *      The last sleep state is provided to the application in the parameter.
+ *
+ *      NOTE: In the case of a power-on reset, this function is called
+ *      after app_power_on_reset().
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+void AppInit(sleep_state last_sleep_state)
+{
+    uint16 gatt_db_length = 0;
+    uint16 *p_gatt_db_pointer = NULL;
+    bool light_poweron = FALSE;
+    bool light_restored;
+    CSR_MESH_ADVSCAN_PARAM_T adv_scan_param;
+
+    BOOT_PHASE_DONE(boot_phase_start);
+
+#ifdef USE_STATIC_RANDOM_ADDRESS
+    /* Generate random address for the CSRmesh Device. */
+    generateStaticRandomAddress(&g_lightapp_data.random_bd_addr);
+
+    /* Set the Static Random Address of the device. */
+    GapSetRandomAddress(&g_lightapp_data.random_bd_addr);
+#endif /* USE_STATIC_RANDOM_ADDRESS */
+
+    /* Initialise the application timers */
+    TimerInit(MAX_APP_TIMERS, (void*)app_timers);
+    SoftTimerInit();
+
+#ifdef DEBUG_ENABLE
+    /* Initialise UART and configure with
+     * default baud rate and port configuration.
+     */
+    DebugInit(UART_BUF_SIZE_BYTES_32, UartDataRxCallback, NULL);
+
+    /* UART Rx threshold is set to 1,
+     * so that every byte received will trigger the rx callback.
+     */
+    UartRead(1, 0);
+#endif /* DEBUG_ENABLE */
+
+#ifdef ENABLE_TRACE
+    AppTraceInit();
+#endif /* ENABLE_TRACE */
+
+    DEBUG_STR("\r\nLight Application\r\n");
+
+    /* Initialise GATT entity */
+    GattInit();
+
+    /* Install GATT Server support for the optional Write procedure
+     * This is mandatory only if control point characteristic is supported.
+     */
+    GattInstallServerWriteLongReliable();
+
+    /* Don't wakeup on UART RX line */
+    SleepWakeOnUartRX(FALSE);
+
+#ifdef NVM_TYPE_EEPROM
+    /* Configure the NVM manager to use I2C EEPROM for NVM store */
+    NvmConfigureI2cEeprom();
+#elif NVM_TYPE_FLASH
+    /* Configure the NVM Manager to use SPI flash for NVM store. */
+    NvmConfigureSpiFlash();
+#endif /* NVM_TYPE_EEPROM */
+
+    NvmDisable();
+
+    /* Initialise Light Hardware */
+    LightHardwareInit();
+
+    /* Bring the light back as stored on NVM before the rest of the
+     * initialisation, which takes a noticeable time.
+     */
+    light_restored = restoreLightState();
+    BOOT_PHASE_DONE(boot_phase_light);
+
+    /* Initialise the GATT and GAP data.
+     * Needs to be done before readPersistentStore
+     */
+    appDataInit();
+
+    /* Read persistent storage.
+     * Call this before CsrMeshInit.
+     */
+    readPersistentStore();
+    BOOT_PHASE_DONE(boot_phase_store);
+
+    /* Initialise the CSRmesh */
+    CsrMeshInit(&g_node_data);
+
+    /* Update Relay status on Light */
+    CsrMeshRelayEnable(g_lightapp_data.bearer_data.bearerRelayActive);
+
+    /* Update promiscuous status */
+    CsrMeshEnablePromiscuousMode(g_lightapp_data.bearer_data.bearerPromiscuous);
+
+    /* Enable Notifications for raw messages */
+    CsrMeshEnableRawMsgEvent(TRUE);
+
+    /* Initialise the light model */
+    LightModelInit(light_model_groups, MAX_MODEL_GROUPS);
+
+    /* Initialise the power model */
+    PowerModelInit(power_model_groups, MAX_MODEL_GROUPS);
+
+    /* Initialise Bearer Model */
+    BearerModelInit();
+
+#ifdef ENABLE_FIRMWARE_MODEL
+    /* Initialise Firmware Model */
+    FirmwareModelInit();
+
+    /* Set Firmware Version */
+    g_lightapp_data.fw_version.major_version = APP_MAJOR_VERSION;
+    g_lightapp_data.fw_version.minor_version = APP_MINOR_VERSION;
+#endif /* ENABLE_FIRMWARE_MODEL */
+
+    /* Initialise Attention Model */
+    AttentionModelInit(attention_model_groups, MAX_MODEL_GROUPS);
+
+#ifdef ENABLE_BATTERY_MODEL
+    BatteryModelInit();
+#endif /* ENABLE_BATTERY_MODEL */
+
+#ifdef ENABLE_DATA_MODEL
+    AppDataStreamInit(data_model_groups, MAX_MODEL_GROUPS);
+#endif /* ENABLE_DATA_MODEL */
+    BOOT_PHASE_DONE(boot_phase_mesh);
+
+    /* Start CSRmesh */
+    CsrMeshStart();
+    BOOT_PHASE_DONE(boot_phase_started);
+
+    /* Get the stored adv scan parameters */
+    CsrMeshGetAdvScanParam(&adv_scan_param);
+
+    /* Read the mesh advertising parameter setting from the CS User Keys */
+    adv_scan_param.advertising_interval =
+                                CSReadUserKey(CSKEY_INDEX_CSRMESH_ADV_INTERVAL);
+    adv_scan_param.advertising_time = 
+                                    CSReadUserKey(CSKEY_INDEX_CSRMESH_ADV_TIME);
+    CsrMeshSetAdvScanParam(&adv_scan_param);
+
+    /* Tell Security Manager module about the value it needs to Initialise it's
+     * diversifier to.
+     */
+    SMInit(0);
+
+    /* Initialise CSRmesh light application State */
+    g_lightapp_data.state = app_state_init;
+
+#ifdef USE_ASSOCIATION_REMOVAL_KEY
+    IOTSwitchInit();
+#endif /* USE_ASSOCIATION_REMOVAL_KEY */
 
-                /* Turn on with old colour value restored */
-                LightHardwarePowerControl(TRUE);
-            }
+    /* Start a timer which does device ID adverts till the time device
+     * is associated
+     */
+    if(app_state_not_associated == g_lightapp_data.assoc_state)
+    {
+        initiateAssociation();
+    }
+    else if(!light_restored)
+    {
+        DEBUG_STR("Light is associated\r\n");
 
-            g_lightapp_data.light_state.power =
-                                            g_lightapp_data.power.power_state;
+        /* Light is associated but was not restored at the start of boot,
+         * as the NVM has just been updated from an earlier layout. Set the
+         * colour from NVM.
+         */
+        LightHardwareSetColor(g_lightapp_data.light_state.red,
+                              g_lightapp_data.light_state.green,
+                              g_lightapp_data.light_state.blue);
 
-            /* Send Power State Information to Model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.power;
-            }
 
-            start_nvm_timer = TRUE;
+        /* Set the light power as read from NVM */
+        if ((g_lightapp_data.power.power_state == POWER_STATE_ON) ||
+            (g_lightapp_data.power.power_state == POWER_STATE_ON_FROM_STANDBY))
+        {
+            light_poweron = TRUE;
         }
-        break;
+        LightHardwarePowerControl(light_poweron);
+    }
 
-        case CSR_MESH_BEARER_SET_STATE:
-        {
-            uint8 *pData = data;
-            g_lightapp_data.bearer_data.bearerRelayActive = BufReadUint16(&pData);
-            g_lightapp_data.bearer_data.bearerEnabled     = BufReadUint16(&pData);
-            g_lightapp_data.bearer_data.bearerPromiscuous = BufReadUint16(&pData);
-
-            /* BLE Advert Bearer is always enabled on this device. */
-            g_lightapp_data.bearer_data.bearerEnabled    |= BLE_BEARER_MASK;
-
-            /* Filter the supported bearers from the bitmap received */
-            g_lightapp_data.bearer_data.bearerRelayActive = 
-                g_lightapp_data.bearer_data.bearerRelayActive & 
-                    (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
-
-            /* Filter the supported bearers from the bitmap received */
-            g_lightapp_data.bearer_data.bearerEnabled = 
-                g_lightapp_data.bearer_data.bearerEnabled & 
-                    (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
-
-            g_lightapp_data.bearer_data.bearerPromiscuous = 
-                g_lightapp_data.bearer_data.bearerPromiscuous & 
-                    (BLE_BEARER_MASK | BLE_GATT_SERVER_BEARER_MASK);
-
-            /* Update the saved values */
-            bearer_relay_active = g_lightapp_data.bearer_data.bearerRelayActive;
-            bearer_promiscuous = g_lightapp_data.bearer_data.bearerPromiscuous;
-
-            /* Update new bearer state */
-            CsrMeshRelayEnable(g_lightapp_data.bearer_data.bearerRelayActive);
-            CsrMeshEnablePromiscuousMode(
-                             g_lightapp_data.bearer_data.bearerPromiscuous);
-
-            /* Update Bearer Model Data to NVM */
-            Nvm_Write((uint16 *)&g_lightapp_data.bearer_data,
-                     sizeof(BEARER_MODEL_STATE_DATA_T), NVM_BEARER_DATA_OFFSET);
-
-            if(g_lightapp_data.state != app_state_connected) 
-            {
-                if(g_lightapp_data.bearer_data.bearerEnabled 
-                                                & BLE_GATT_SERVER_BEARER_MASK)
-                {
-                    AppSetState(app_state_advertising);
-                }
-                else
-                {
-                    AppSetState(app_state_idle);
-                }
-            }
+    /* Tell GATT about our database. We will get a GATT_ADD_DB_CFM event when
+     * this has completed.
+     */
+    p_gatt_db_pointer = GattGetDatabase(&gatt_db_length);
+    GattAddDatabaseReq(gatt_db_length, p_gatt_db_pointer);
+    BOOT_PHASE_DONE(boot_phase_done);
 
-            /* Update LastETag. */
-            update_lastetag = TRUE;
-        }
-        /* Fall through */
-        case CSR_MESH_BEARER_GET_STATE:
+#ifdef ENABLE_BOOT_TIMING
+    {
+        boot_phase phase;
+
+        /* Report the time taken by each phase, time-to-light first */
+        DEBUG_STR("Boot phase times (us):");
+        for(phase = boot_phase_light; phase < boot_phase_count; phase++)
         {
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.bearer_data;
-            }
+            DEBUG_STR(" ");
+            DEBUG_U32(boot_phase_time[phase] - boot_phase_time[phase - 1]);
         }
-        break;
+        DEBUG_STR("\r\n");
+    }
+#endif /* ENABLE_BOOT_TIMING */
+}
 
-#ifdef ENABLE_FIRMWARE_MODEL
-        case CSR_MESH_FIRMWARE_GET_VERSION_INFO:
+/*-----------------------------------------------------------------------------*
+ *  NAME
+ *      AppProcesSystemEvent
+ *
+ *  DESCRIPTION
+ *      This user application function is called whenever a system event, such
+ *      as a battery low notification, is received by the system.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+void AppProcessSystemEvent(sys_event_id id, void *data)
+{
+    TRACE(trace_system_event, id, 0);
+    switch (id)
+    {
+        case sys_event_pio_changed:
         {
-            /* Send Firmware Version data to the model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.fw_version;
-            }
+#ifdef USE_ASSOCIATION_REMOVAL_KEY
+            handlePIOEvent((pio_changed_data*)data);
+#endif
         }
         break;
 
-        case CSR_MESH_FIRMWARE_UPDATE_REQUIRED:
-        {
-            BD_ADDR_T *pBDAddr = NULL;
-#ifdef USE_STATIC_RANDOM_ADDRESS
-            pBDAddr = &g_lightapp_data.random_bd_addr;
-#endif /* USE_STATIC_RANDOM_ADDRESS */
-
-            DEBUG_STR("\r\n FIRMWARE UPDATE IN PROGRESS \r\n");
-
-            /* Write the value CSR_OTA_BOOT_LOADER to NVM so that
-             * it starts in OTA mode upon reset
-             */
-            OtaWriteCurrentApp(csr_ota_boot_loader,
-                               FALSE,   /* is bonded */
-                               NULL,    /* Typed host BD Address */
-                               0,       /* Diversifier */
-                               pBDAddr, /* local_random_address */
-                               NULL,    /* irk */
-                               FALSE    /* service_changed_config */
-                              );
-
-           /* Defer OTA Reset for half a second to ensure that,
-            * acknowledgements are sent before reset.
-            */
-           ota_rst_tid = TimerCreate(OTA_RESET_DEFER_DURATION, TRUE,
-                                     issueOTAReset);
-
-           /* Update LastETag. */
-           update_lastetag = TRUE;
-        }
+        default:
         break;
-#endif /* ENABLE_FIRMWARE_MODEL */
+    }
+}
 
-#ifdef ENABLE_BATTERY_MODEL
-        case CSR_MESH_BATTERY_GET_STATE:
-        {
-            /* Initialise battery state. IOT  boards (H13323) are battery powered */
-            g_lightapp_data.battery_data.battery_state = 
-                                            BATTERY_MODEL_STATE_POWERING_DEVICE;
-            /* Read Battery Level */
-            g_lightapp_data.battery_data.battery_level = ReadBatteryLevel();
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AppProcessLmEvent
+ *
+ *  DESCRIPTION
+ *      This user application function is called whenever a LM-specific event
+ *      is received by the system.
+ *
+ * PARAMETERS
+ *      event_code [in]   LM event ID
+ *      event_data [in]   LM event data
+ *
+ * RETURNS
+ *      TRUE if the application has finished with the event data;
+ *           the control layer will free the buffer.
+ *----------------------------------------------------------------------------*/
+extern bool AppProcessLmEvent(lm_event_code event_code,
+                              LM_EVENT_T *p_event_data)
+{
+    TRACE(trace_lm_event, event_code, 0);
+    switch(event_code)
+    {
+        /* Handle events received from Firmware */
 
-            if(g_lightapp_data.battery_data.battery_level == 0)
-            {
-                /* Voltage is below flat battery voltage. Set the needs 
-                 * replacement flag in the battery state
-                 */
-                g_lightapp_data.battery_data.battery_state |=
-                                          BATTERY_MODEL_STATE_NEEDS_REPLACEMENT;
-            }
-            /* Pass Battery state data to model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.battery_data;
-            }
-        }
+        case GATT_ADD_DB_CFM:
+            /* Attribute database registration confirmation */
+            handleSignalGattAddDBCfm((GATT_ADD_DB_CFM_T*)p_event_data);
         break;
-#endif /* ENABLE_BATTERY_MODEL */
 
-        case CSR_MESH_ATTENTION_SET_STATE:
-        {
-            uint32 dur_us;
-            /* Read the data */
-            g_lightapp_data.attn_data.attract_attn  = BufReadUint8(&data);
-            g_lightapp_data.attn_data.attn_duration = BufReadUint16(&data);
+        case GATT_CANCEL_CONNECT_CFM:
+            /* Confirmation for the completion of GattCancelConnectReq()
+             * procedure
+             */
+            handleSignalGattCancelConnectCfm();
+        break;
 
-            /* Delete attention timer if it exists */
-            if (TIMER_INVALID != attn_tid)
-            {
-                TimerDelete(attn_tid);
-                attn_tid = TIMER_INVALID;
-            }
+        case LM_EV_CONNECTION_COMPLETE:
+            /* Handle the LM connection complete event. */
+            handleSignalLmEvConnectionComplete((LM_EV_CONNECTION_COMPLETE_T*)
+                                                                p_event_data);
+        break;
 
-            /* If attention Enabled */
-            if (g_lightapp_data.attn_data.attract_attn)
-            {
-                /* Create attention duration timer if required */
-                if (g_lightapp_data.attn_data.attn_duration != 0xFFFF)
-                {
-                    dur_us = (uint32)g_lightapp_data.attn_data.attn_duration * \
-                                     MILLISECOND;
-                    attn_tid = TimerCreate(dur_us, TRUE, attnTimerHandler);
-                }
+        case GATT_CONNECT_CFM:
+            /* Confirmation for the completion of GattConnectReq()
+             * procedure
+             */
+            handleSignalGattConnectCfm((GATT_CONNECT_CFM_T*)p_event_data);
+        break;
 
-                /* Enable Red light blinking to attract attention */
-                LightHardwareSetBlink(127, 0, 0, 32, 32);
-            }
-            else
-            {
-                /* Restore Light State */
-                LightHardwareSetColor(g_lightapp_data.light_state.red,
-                                      g_lightapp_data.light_state.green,
-                                      g_lightapp_data.light_state.blue);
+        case SM_SIMPLE_PAIRING_COMPLETE_IND:
+            /* Indication for completion of Pairing procedure */
+            handleSignalSmSimplePairingCompleteInd(
+                (SM_SIMPLE_PAIRING_COMPLETE_IND_T*)p_event_data);
+        break;
 
-                /* Restore the light Power State */
-                LightHardwarePowerControl(g_lightapp_data.power.power_state);
-            }
+        case LM_EV_ENCRYPTION_CHANGE:
+            /* Indication for encryption change event */
+            /* Nothing to do */
+        break;
 
-            /* Send response data to model */
-            if (state_data != NULL)
-            {
-                *state_data = (void *)&g_lightapp_data.attn_data;
-            }
+        /* Received in response to the LsConnectionParamUpdateReq()
+         * request sent from the slave after encryption is enabled. If
+         * the request has failed, the device should again send the same
+         * request only after Tgap(conn_param_timeout). Refer Bluetooth 4.0
+         * spec Vol 3 Part C, Section 9.3.9 and HID over GATT profile spec
+         * section 5.1.2.
+         */
+        case LS_CONNECTION_PARAM_UPDATE_CFM:
+            handleSignalLsConnParamUpdateCfm(
+                (LS_CONNECTION_PARAM_UPDATE_CFM_T*) p_event_data);
+        break;
 
-            /* Debug logs */
-            DEBUG_STR("\r\n ATTENTION_SET_STATE : Enable :");
-            DEBUG_U8(g_lightapp_data.attn_data.attract_attn);
-            DEBUG_STR("Duration : ");
-            DEBUG_U16(g_lightapp_data.attn_data.attn_duration);
-            DEBUG_STR("\r\n");
+        case LM_EV_CONNECTION_UPDATE:
+            /* This event is sent by the controller on connection parameter
+             * update.
+             */
+            handleSignalLmConnectionUpdate(
+                            (LM_EV_CONNECTION_UPDATE_T*)p_event_data);
+        break;
 
-        }
+        case LS_CONNECTION_PARAM_UPDATE_IND:
+            /* Indicates completion of remotely triggered Connection
+             * parameter update procedure
+             */
+            handleSignalLsConnParamUpdateInd(
+                            (LS_CONNECTION_PARAM_UPDATE_IND_T *)p_event_data);
         break;
 
-#ifdef ENABLE_DATA_MODEL
-        /* Data stream model messages */
-        case CSR_MESH_DATA_STREAM_SEND_CFM:
-        {
-            handleCSRmeshDataStreamSendCfm((CSR_MESH_STREAM_EVENT_T *)data);
-        }
+        case GATT_ACCESS_IND:
+            /* Indicates that an attribute controlled directly by the
+             * application (ATT_ATTR_IRQ attribute flag is set) is being
+             * read from or written to.
+             */
+            handleSignalGattAccessInd((GATT_ACCESS_IND_T*)p_event_data);
         break;
 
-        case CSR_MESH_DATA_STREAM_DATA_IND:
-        {
-            handleCSRmeshDataStreamDataInd((CSR_MESH_STREAM_EVENT_T *)data);
-        }
+        case GATT_DISCONNECT_IND:
+            /* Disconnect procedure triggered by remote host or due to
+             * link loss is considered complete on reception of
+             * LM_EV_DISCONNECT_COMPLETE event. So, it gets handled on
+             * reception of LM_EV_DISCONNECT_COMPLETE event.
+             */
+         break;
+
+        case GATT_DISCONNECT_CFM:
+            /* Confirmation for the completion of GattDisconnectReq()
+             * procedure is ignored as the procedure is considered complete
+             * on reception of LM_EV_DISCONNECT_COMPLETE event. So, it gets
+             * handled on reception of LM_EV_DISCONNECT_COMPLETE event.
+             */
         break;
 
-        /* Stream flush indication */
-        case CSR_MESH_DATA_STREAM_FLUSH_IND:
+        case LM_EV_DISCONNECT_COMPLETE:
         {
-            handleCSRmeshDataStreamFlushInd((CSR_MESH_STREAM_EVENT_T *)data);
+            /* Disconnect procedures either triggered by application or remote
+             * host or link loss case are considered completed on reception
+             * of LM_EV_DISCONNECT_COMPLETE event
+             */
+             handleSignalLmDisconnectComplete(
+                    &((LM_EV_DISCONNECT_COMPLETE_T *)p_event_data)->data);
         }
         break;
 
-        /* Received a single block of data */
-        case CSR_MESH_DATA_BLOCK_IND:
+        case LM_EV_ADVERTISING_REPORT:
         {
-            handleCSRmeshDataBlockInd((CSR_MESH_STREAM_EVENT_T *)data);
+            CsrMeshProcessMessage((LM_EV_ADVERTISING_REPORT_T *)p_event_data);
         }
         break;
-#endif /* ENABLE_DATA_MODEL */
 
-        /* Received a raw message from lower-layers.
-         * Notify to the control device if connected.
-         */
-        case CSR_MESH_RAW_MESSAGE:
+        case LS_RADIO_EVENT_IND:
         {
-            if (g_lightapp_data.state == app_state_connected)
-            {
-                MeshControlNotifyResponse(g_lightapp_data.gatt_data.st_ucid,
-                                          data, length);
-            }
+            CsrMeshHandleRadioEvent();
         }
         break;
 
         default:
+            /* Ignore any other event */
         break;
+
     }
 
-    /* Commit Update LastETag. */
-    if (update_lastetag)
+    return TRUE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AppProcessCsrMeshEvent
+ *
+ *  DESCRIPTION
+ *      This user application function is called whenever a CSRmesh event
+ *      is received by the system.
+ *
+ * PARAMETERS
+ *      event_code csr_mesh_event_t
+ *      data       Data associated with the event
+ *      length     Length of the data
+ *      state_data Pointer to the variable pointing to state data.
+ *
+ * RETURNS
+ *      TRUE if the app has finished with the event data; the control layer
+ *      will free the buffer.
+ *----------------------------------------------------------------------------*/
+extern void AppProcessCsrMeshEvent(csr_mesh_event_t event_code, uint8* data,
+                                   uint16 length, void **state_data)
+{
+    const MESH_EVENT_ENTRY_T *p_entry;
+#ifdef ENABLE_MESH_EVENT_STATS
+    uint32 start_time = TimeGet32();
+#endif /* ENABLE_MESH_EVENT_STATS */
+
+    TRACE(trace_mesh_event, event_code, 0);
+
+    if (event_code >= MESH_EVENT_TABLE_SIZE)
     {
-        CsrMeshUpdateLastETag(&g_node_data.device_ETag);
-        /* Save the device ETag on NVM */
-        NvmWrite(g_node_data.device_ETag.ETag, sizeof(CSR_MESH_ETAG_T),
-                                                        NVM_OFFSET_DEVICE_ETAG);
+        /* Event not handled by the application, and beyond the statistics */
+        return;
     }
 
-    /* Start NVM timer if required */
-    if (TRUE == start_nvm_timer)
+    p_entry = &mesh_event_handlers[event_code];
+    if (p_entry->handler != NULL &&
+        p_entry->handler(event_code, data, length, state_data))
     {
-        /* Delete existing timer */
-        if (TIMER_INVALID != g_lightapp_data.nvm_tid)
+        /* Commit Update LastETag. */
+        if (p_entry->flags & MESH_EVENT_UPDATE_ETAG)
         {
-            TimerDelete(g_lightapp_data.nvm_tid);
+            CsrMeshUpdateLastETag(&g_node_data.device_ETag);
+            /* Save the device ETag on NVM */
+            storeDeviceETag();
         }
 
-        /* Re-start the timer */
-        g_lightapp_data.nvm_tid = TimerCreate(NVM_WRITE_DEFER_DURATION,
-                                              TRUE,
-                                              lightDataNVMWriteTimerHandler);
+        /* Start NVM timer if required */
+        if (p_entry->flags & MESH_EVENT_WRITE_LIGHT_STATE)
+        {
+            /* Restart the timer */
+            SoftTimerStart(&g_lightapp_data.nvm_timer,
+                           NVM_WRITE_DEFER_DURATION,
+                           lightDataNVMWriteTimerHandler);
+        }
     }
+
+#ifdef ENABLE_MESH_EVENT_STATS
+    recordMeshEventTime(event_code, TimeGet32() - start_time);
+#endif /* ENABLE_MESH_EVENT_STATS */
 }
 
@@ -35,10 +35,20 @@
 #include <battery_model.h>
 #endif /* ENABLE_BATTERY_MODEL */
 
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+#include "soft_timer.h"
+
 /*============================================================================*
  *  Public Definitions
  *============================================================================*/
 
+/* Size of the CSRmesh event handler table, one more than the highest event
+ * code handled by the application
+ */
+#define MESH_EVENT_TABLE_SIZE          (CSR_MESH_RAW_MESSAGE + 1)
+
 /*============================================================================*
  *  Public Data Types
  *============================================================================*/
@@ -113,10 +123,8 @@ typedef struct
      */
     uint8                          num_conn_update_req;
 
-    /* Store timer id for Connection Parameter Update timer in Connected
-     * state
-     */
-    timer_id                       con_param_update_tid;
+    /* Connection Parameter Update timer in Connected state */
+    SOFT_TIMER_T                   con_param_update_timer;
 
     /* Connection Parameter Update timer value. Upon a connection, it's started
      * for a period of TGAP_CPP_PERIOD, upon the expiry of which it's restarted
@@ -173,9 +181,37 @@ typedef struct
 #endif
 
     /* Timer to check for RGB change and store on NVM */
-    timer_id                       nvm_tid;
+    SOFT_TIMER_T                   nvm_timer;
 } CSRMESH_LIGHT_DATA_T;
 
+/* Counters of the device ETag persistence */
+typedef struct
+{
+    /* ETag updates written to NVM */
+    uint16                         writes;
+
+    /* ETag updates not written as NVM already held the same ETag */
+    uint16                         avoided;
+} ETAG_STATS_T;
+
+#ifdef ENABLE_MESH_EVENT_STATS
+/* Processing time statistics of a CSRmesh event code. Times are in
+ * microseconds, with the minimum and maximum saturated to 16 bits.
+ */
+typedef struct
+{
+    /* Number of events processed */
+    uint16                         count;
+
+    /* Shortest and longest processing time */
+    uint16                         min_time;
+    uint16                         max_time;
+
+    /* Total processing time */
+    uint32                         total_time;
+} MESH_EVENT_STATS_T;
+#endif /* ENABLE_MESH_EVENT_STATS */
+
 /*============================================================================*
  *  Public Data
  *============================================================================*/
@@ -196,5 +232,14 @@ extern void HandleShortButtonPress(void);
 /* This function generate random delays */
 extern uint16 AppRandomDelay(void);
 
+/* This function reads the counters of the device ETag persistence */
+extern void AppGetETagStats(ETAG_STATS_T *p_stats);
+
+#ifdef ENABLE_MESH_EVENT_STATS
+/* This function reads the processing time statistics of a CSRmesh event */
+extern void AppGetMeshEventStats(csr_mesh_event_t event_code,
+                                 MESH_EVENT_STATS_T *p_stats);
+#endif /* ENABLE_MESH_EVENT_STATS */
+
 #endif /* __CSR_MESH_LIGHT_H__ */
 
@@ -30,148 +30,253 @@
 #endif
 
 #include "csr_mesh_light_hw.h"
+#include "app_gatt.h"
 
 /*============================================================================*
  *  Private Data
  *============================================================================*/
-/* Color temperature calculation parameters */
-/* Temperature is stored in 500 kelvin units */
-#define CCT_TEMP_FACTOR             (500)
-#define PACK_CCT_LEVEL(temp, level) (((uint16)level << 8)| \
-                                     ((temp/CCT_TEMP_FACTOR) & 0xFF))
-#define GET_LEVEL(val)              ((val >> 8) & 0xFF)
-#define GET_TEMP(val)               (val & 0xFF)
-#define LUT_SIZE(lut)               (sizeof(lut)/sizeof(lut[0]))
-
-
-#ifdef COLOUR_TEMP_ENABLED
-/* Look up tables for color temperature
- * (lower byte is Temperature in 500 kelvin units)
- * and color level (higher byte).
+#ifndef GUNILAMP
+/* Scale of the brightness look up table, a 16 bit duty cycle multiplied by
+ * an entry of the table is shifted right by this many bits.
  */
+#define LEVEL_LUT_SHIFT             (16)
 
-/* LUT for Red */
-static const uint16 cct_red_lut[] =
+/* Look up table mapping the 0-255 brightness level to the relative luminance
+ * of the light in 1/65536 units, so that equal level steps are perceived as
+ * equal brightness steps. The entries follow the CIE 1931 lightness curve,
+ * with L = 100 * level / 255:
+ *     Y = L / 903.3                   for L <= 8
+ *     Y = ((L + 16) / 116) ^ 3        otherwise
+ * and are round(65536 * Y), the last one saturated to 65535. The table is
+ * strictly increasing and only its first entry is 0, which checkLevelLut
+ * checks at boot if ENABLE_LEVEL_LUT_CHECK is defined.
+ */
+static const uint16 level_lut[256] =
 {
-    PACK_CCT_LEVEL(  6500, 255),
-    PACK_CCT_LEVEL(  7000, 245),
-    PACK_CCT_LEVEL(  8000, 227),
-    PACK_CCT_LEVEL( 10000, 204),
-    PACK_CCT_LEVEL( 12500, 188),
-    PACK_CCT_LEVEL( 15000, 179),
-    PACK_CCT_LEVEL( 20000, 168),
-    PACK_CCT_LEVEL( 25000, 163),
-    PACK_CCT_LEVEL( 30000, 159),
-    PACK_CCT_LEVEL( 35000, 157),
-    PACK_CCT_LEVEL( 40000, 155)
+        0,    28,    57,    85,   114,   142,   171,   199,
+      228,   256,   285,   313,   341,   370,   398,   427,
+      455,   484,   512,   541,   569,   598,   627,   658,
+      689,   721,   755,   789,   825,   861,   899,   937,
+      977,  1018,  1060,  1103,  1147,  1192,  1239,  1287,
+     1336,  1386,  1437,  1490,  1544,  1599,  1656,  1714,
+     1773,  1834,  1896,  1959,  2024,  2090,  2157,  2226,
+     2297,  2369,  2442,  2517,  2593,  2671,  2751,  2832,
+     2915,  2999,  3085,  3172,  3261,  3352,  3444,  3538,
+     3634,  3732,  3831,  3932,  4035,  4139,  4246,  4354,
+     4464,  4575,  4689,  4804,  4922,  5041,  5162,  5285,
+     5410,  5537,  5666,  5797,  5930,  6065,  6202,  6341,
+     6483,  6626,  6771,  6918,  7068,  7220,  7373,  7529,
+     7688,  7848,  8011,  8175,  8342,  8512,  8683,  8857,
+     9033,  9212,  9393,  9576,  9762,  9950, 10140, 10333,
+    10528, 10726, 10926, 11128, 11333, 11541, 11751, 11964,
+    12179, 12396, 12617, 12840, 13065, 13293, 13524, 13758,
+    13994, 14232, 14474, 14718, 14965, 15215, 15467, 15723,
+    15981, 16241, 16505, 16772, 17041, 17313, 17588, 17866,
+    18147, 18431, 18718, 19007, 19300, 19596, 19895, 20196,
+    20501, 20809, 21120, 21434, 21751, 22071, 22394, 22721,
+    23050, 23383, 23719, 24058, 24401, 24746, 25095, 25447,
+    25803, 26161, 26523, 26889, 27257, 27629, 28005, 28383,
+    28766, 29151, 29540, 29933, 30329, 30728, 31131, 31537,
+    31947, 32361, 32778, 33198, 33623, 34050, 34482, 34917,
+    35355, 35798, 36244, 36693, 37147, 37604, 38065, 38529,
+    38997, 39470, 39946, 40425, 40909, 41396, 41887, 42383,
+    42882, 43384, 43891, 44402, 44917, 45435, 45958, 46485,
+    47015, 47550, 48089, 48631, 49178, 49729, 50284, 50843,
+    51407, 51974, 52546, 53121, 53701, 54285, 54874, 55466,
+    56063, 56664, 57270, 57879, 58493, 59112, 59734, 60361,
+    60993, 61628, 62269, 62913, 63562, 64216, 64874, 65535
 };
+#endif /* GUNILAMP */
+
+
+#ifdef COLOUR_TEMP_ENABLED
+/* Colour temperature range covered by the look up table, in kelvin */
+#define CCT_LUT_MIN_TEMP            (1000)
+#define CCT_LUT_STEP                (153)
+#define CCT_LUT_SIZE                (256)
+
+/* Packs the colour levels of an entry of the colour temperature table */
+#define CCT_RGB(red, green, blue)   {(((uint16)(green) << 8) | (red)), (blue)}
 
-/* LUT for Green */
-static const uint16 cct_green_lut[] =
+/* Colour levels at a colour temperature */
+typedef struct
 {
-    PACK_CCT_LEVEL(  1000,  51),
-    PACK_CCT_LEVEL(  1500, 109),
-    PACK_CCT_LEVEL(  2500, 161),
-    PACK_CCT_LEVEL(  3000, 180),
-    PACK_CCT_LEVEL(  4000, 209),
-    PACK_CCT_LEVEL(  5000, 228),
-    PACK_CCT_LEVEL(  6000, 243),
-    PACK_CCT_LEVEL(  6500, 249),
-    PACK_CCT_LEVEL(  7000, 243),
-    PACK_CCT_LEVEL(  9000, 225),
-    PACK_CCT_LEVEL( 12000, 211),
-    PACK_CCT_LEVEL( 18000, 199),
-    PACK_CCT_LEVEL( 25000, 193),
-    PACK_CCT_LEVEL( 38000, 188)
-};
+    /* 0-255 level of Red in the lower byte, Green in the higher byte */
+    uint16                          red_green;
+
+    /* 0-255 level of Blue */
+    uint16                          blue;
 
-/* LUT for Blue */
-static const uint16 cct_blue_lut[] =
+} CCT_LUT_ENTRY_T;
+
+/* Look up table for colour temperature. Entry n holds the colour levels at
+ * CCT_LUT_MIN_TEMP + n * CCT_LUT_STEP kelvin, covering 1000 K to 40015 K.
+ * The levels are linearly interpolated, rounding to nearest, between the
+ * following colours of the black body (Mitchell Charity, 10 degree CMFs).
+ * The levels saturate below the first and above the last point of a colour.
+ *
+ *  Red:   6500 K 255,  7000 K 245,  8000 K 227, 10000 K 204, 12500 K 188,
+ *        15000 K 179, 20000 K 168, 25000 K 163, 30000 K 159, 35000 K 157,
+ *        40000 K 155
+ *  Green: 1000 K  51,  1500 K 109,  2500 K 161,  3000 K 180,  4000 K 209,
+ *         5000 K 228,  6000 K 243,  6500 K 249,  7000 K 243,  9000 K 225,
+ *        12000 K 211, 18000 K 199, 25000 K 193, 38000 K 188
+ *  Blue:  1500 K   0,  2000 K  18,  2500 K  72,  3000 K 107,  4000 K 163,
+ *         5000 K 206,  6000 K 239,  6500 K 253,  7000 K 255
+ */
+static const CCT_LUT_ENTRY_T cct_lut[CCT_LUT_SIZE] =
 {
-    PACK_CCT_LEVEL( 1500,   0),
-    PACK_CCT_LEVEL( 2000,  18),
-    PACK_CCT_LEVEL( 2500,  72),
-    PACK_CCT_LEVEL( 3000, 107),
-    PACK_CCT_LEVEL( 4000, 163),
-    PACK_CCT_LEVEL( 5000, 206),
-    PACK_CCT_LEVEL( 6000, 239),
-    PACK_CCT_LEVEL( 6500, 253),
-    PACK_CCT_LEVEL( 7000, 255)
+    CCT_RGB(255,  51,   0), CCT_RGB(255,  69,   0), CCT_RGB(255,  86,   0),
+    CCT_RGB(255, 104,   0), CCT_RGB(255, 115,   4), CCT_RGB(255, 123,  10),
+    CCT_RGB(255, 131,  15), CCT_RGB(255, 139,  26), CCT_RGB(255, 147,  42),
+    CCT_RGB(255, 155,  59), CCT_RGB(255, 162,  74), CCT_RGB(255, 168,  85),
+    CCT_RGB(255, 174,  96), CCT_RGB(255, 180, 106), CCT_RGB(255, 184, 115),
+    CCT_RGB(255, 189, 124), CCT_RGB(255, 193, 132), CCT_RGB(255, 197, 141),
+    CCT_RGB(255, 202, 149), CCT_RGB(255, 206, 158), CCT_RGB(255, 210, 166),
+    CCT_RGB(255, 213, 172), CCT_RGB(255, 216, 179), CCT_RGB(255, 219, 185),
+    CCT_RGB(255, 222, 192), CCT_RGB(255, 225, 198), CCT_RGB(255, 228, 205),
+    CCT_RGB(255, 230, 210), CCT_RGB(255, 232, 215), CCT_RGB(255, 235, 220),
+    CCT_RGB(255, 237, 225), CCT_RGB(255, 239, 231), CCT_RGB(255, 241, 236),
+    CCT_RGB(255, 244, 240), CCT_RGB(255, 245, 245), CCT_RGB(255, 247, 249),
+    CCT_RGB(255, 249, 253), CCT_RGB(252, 247, 254), CCT_RGB(249, 245, 254),
+    CCT_RGB(246, 243, 255), CCT_RGB(243, 242, 255), CCT_RGB(240, 241, 255),
+    CCT_RGB(237, 239, 255), CCT_RGB(235, 238, 255), CCT_RGB(232, 236, 255),
+    CCT_RGB(229, 235, 255), CCT_RGB(227, 234, 255), CCT_RGB(225, 232, 255),
+    CCT_RGB(223, 231, 255), CCT_RGB(221, 230, 255), CCT_RGB(220, 228, 255),
+    CCT_RGB(218, 227, 255), CCT_RGB(216, 225, 255), CCT_RGB(214, 224, 255),
+    CCT_RGB(212, 224, 255), CCT_RGB(211, 223, 255), CCT_RGB(209, 222, 255),
+    CCT_RGB(207, 222, 255), CCT_RGB(205, 221, 255), CCT_RGB(204, 220, 255),
+    CCT_RGB(203, 219, 255), CCT_RGB(202, 219, 255), CCT_RGB(201, 218, 255),
+    CCT_RGB(200, 217, 255), CCT_RGB(199, 217, 255), CCT_RGB(198, 216, 255),
+    CCT_RGB(197, 215, 255), CCT_RGB(196, 214, 255), CCT_RGB(195, 214, 255),
+    CCT_RGB(194, 213, 255), CCT_RGB(193, 212, 255), CCT_RGB(192, 212, 255),
+    CCT_RGB(191, 211, 255), CCT_RGB(190, 211, 255), CCT_RGB(189, 210, 255),
+    CCT_RGB(188, 210, 255), CCT_RGB(188, 210, 255), CCT_RGB(187, 209, 255),
+    CCT_RGB(186, 209, 255), CCT_RGB(186, 209, 255), CCT_RGB(185, 209, 255),
+    CCT_RGB(185, 208, 255), CCT_RGB(184, 208, 255), CCT_RGB(184, 208, 255),
+    CCT_RGB(183, 207, 255), CCT_RGB(183, 207, 255), CCT_RGB(182, 207, 255),
+    CCT_RGB(181, 206, 255), CCT_RGB(181, 206, 255), CCT_RGB(180, 206, 255),
+    CCT_RGB(180, 205, 255), CCT_RGB(179, 205, 255), CCT_RGB(179, 205, 255),
+    CCT_RGB(178, 205, 255), CCT_RGB(178, 204, 255), CCT_RGB(178, 204, 255),
+    CCT_RGB(177, 204, 255), CCT_RGB(177, 203, 255), CCT_RGB(177, 203, 255),
+    CCT_RGB(176, 203, 255), CCT_RGB(176, 202, 255), CCT_RGB(176, 202, 255),
+    CCT_RGB(175, 202, 255), CCT_RGB(175, 201, 255), CCT_RGB(175, 201, 255),
+    CCT_RGB(174, 201, 255), CCT_RGB(174, 201, 255), CCT_RGB(174, 200, 255),
+    CCT_RGB(173, 200, 255), CCT_RGB(173, 200, 255), CCT_RGB(173, 199, 255),
+    CCT_RGB(172, 199, 255), CCT_RGB(172, 199, 255), CCT_RGB(172, 199, 255),
+    CCT_RGB(171, 199, 255), CCT_RGB(171, 198, 255), CCT_RGB(171, 198, 255),
+    CCT_RGB(170, 198, 255), CCT_RGB(170, 198, 255), CCT_RGB(170, 198, 255),
+    CCT_RGB(169, 198, 255), CCT_RGB(169, 198, 255), CCT_RGB(169, 198, 255),
+    CCT_RGB(168, 197, 255), CCT_RGB(168, 197, 255), CCT_RGB(168, 197, 255),
+    CCT_RGB(168, 197, 255), CCT_RGB(168, 197, 255), CCT_RGB(167, 197, 255),
+    CCT_RGB(167, 197, 255), CCT_RGB(167, 197, 255), CCT_RGB(167, 196, 255),
+    CCT_RGB(167, 196, 255), CCT_RGB(167, 196, 255), CCT_RGB(166, 196, 255),
+    CCT_RGB(166, 196, 255), CCT_RGB(166, 196, 255), CCT_RGB(166, 196, 255),
+    CCT_RGB(166, 195, 255), CCT_RGB(166, 195, 255), CCT_RGB(166, 195, 255),
+    CCT_RGB(165, 195, 255), CCT_RGB(165, 195, 255), CCT_RGB(165, 195, 255),
+    CCT_RGB(165, 195, 255), CCT_RGB(165, 195, 255), CCT_RGB(165, 194, 255),
+    CCT_RGB(165, 194, 255), CCT_RGB(164, 194, 255), CCT_RGB(164, 194, 255),
+    CCT_RGB(164, 194, 255), CCT_RGB(164, 194, 255), CCT_RGB(164, 194, 255),
+    CCT_RGB(164, 194, 255), CCT_RGB(163, 193, 255), CCT_RGB(163, 193, 255),
+    CCT_RGB(163, 193, 255), CCT_RGB(163, 193, 255), CCT_RGB(163, 193, 255),
+    CCT_RGB(163, 193, 255), CCT_RGB(163, 193, 255), CCT_RGB(162, 193, 255),
+    CCT_RGB(162, 193, 255), CCT_RGB(162, 193, 255), CCT_RGB(162, 193, 255),
+    CCT_RGB(162, 193, 255), CCT_RGB(162, 192, 255), CCT_RGB(162, 192, 255),
+    CCT_RGB(162, 192, 255), CCT_RGB(162, 192, 255), CCT_RGB(161, 192, 255),
+    CCT_RGB(161, 192, 255), CCT_RGB(161, 192, 255), CCT_RGB(161, 192, 255),
+    CCT_RGB(161, 192, 255), CCT_RGB(161, 192, 255), CCT_RGB(161, 192, 255),
+    CCT_RGB(161, 192, 255), CCT_RGB(160, 192, 255), CCT_RGB(160, 192, 255),
+    CCT_RGB(160, 192, 255), CCT_RGB(160, 192, 255), CCT_RGB(160, 192, 255),
+    CCT_RGB(160, 191, 255), CCT_RGB(160, 191, 255), CCT_RGB(160, 191, 255),
+    CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255),
+    CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255),
+    CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255),
+    CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255), CCT_RGB(159, 191, 255),
+    CCT_RGB(158, 191, 255), CCT_RGB(158, 191, 255), CCT_RGB(158, 190, 255),
+    CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255),
+    CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255),
+    CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255),
+    CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255),
+    CCT_RGB(158, 190, 255), CCT_RGB(158, 190, 255), CCT_RGB(157, 190, 255),
+    CCT_RGB(157, 190, 255), CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255),
+    CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255),
+    CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255),
+    CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255),
+    CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255), CCT_RGB(157, 189, 255),
+    CCT_RGB(156, 189, 255), CCT_RGB(156, 189, 255), CCT_RGB(156, 189, 255),
+    CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255),
+    CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255),
+    CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255),
+    CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255), CCT_RGB(156, 188, 255),
+    CCT_RGB(156, 188, 255), CCT_RGB(155, 188, 255), CCT_RGB(155, 188, 255),
+    CCT_RGB(155, 188, 255), CCT_RGB(155, 188, 255), CCT_RGB(155, 188, 255),
+    CCT_RGB(155, 188, 255), CCT_RGB(155, 188, 255), CCT_RGB(155, 188, 255),
+    CCT_RGB(155, 188, 255)
 };
+#endif /* COLOUR_TEMP_ENABLED */
 
-/*============================================================================*
- *  Private Function Prototypes
- *============================================================================*/
-/* Function to convert Color temperature to level from LUT */
-static uint8 getLevelFromCCTLut(uint16 temp, const uint16 *color_lut,
-                                             uint16 sizeof_lut);
-
+#ifndef GUNILAMP
 /*============================================================================*
  *  Private Function Implementations
  *============================================================================*/
+
+#ifdef ENABLE_LEVEL_LUT_CHECK
 /*----------------------------------------------------------------------------*
  *  NAME
- *      getLevelFromCCTLut
+ *      checkLevelLut
  *
  *  DESCRIPTION
- *      This function linearly interpolates the color value from LUT and
- *      color temperature.
+ *      This function checks that the brightness look up table is strictly
+ *      increasing from 0, so that every non-zero brightness level lights a
+ *      non-zero colour component and no two levels give the same brightness.
+ *      It panics otherwise.
  *
- *  RETURNS
- *      Level of the colour from 0 - 255.
+ * RETURNS
+ *      Nothing.
  *
- *---------------------------------------------------------------------------*/
-static uint8 getLevelFromCCTLut(uint16 temp, const uint16 *color_lut,
-                                             uint16 sizeof_lut)
+ *----------------------------------------------------------------------------*/
+static void checkLevelLut(void)
 {
-    uint16 idx;
-    int16  x2,y2,x1,y1;
-    int32  val;
-    uint16 thk = temp/CCT_TEMP_FACTOR;
+    uint16 level;
+
+    if (level_lut[0] != 0)
+    {
+        ReportPanic(app_panic_level_lut);
+    }
 
-    for (idx = 0; idx < sizeof_lut; idx++)
+    for (level = 1; level < 256; level++)
     {
-        /* Find the temperature just greater than temperature to be set */
-        if (thk < GET_TEMP(color_lut[idx]))
+        if (level_lut[level] <= level_lut[level - 1])
         {
-            if (0 == idx)
-            {
-                /* if the temperature is less than first LUT element
-                 * then saturate at that value.
-                 */
-                return GET_LEVEL(color_lut[idx]);
-            }
-            else
-            {
-                /* Get the points on interpolation line
-                 * Multiply temperature by unit factor to get value
-                 * in kelvin.
-                 */
-                y1 = (int16)GET_LEVEL(color_lut[idx - 1]);
-                x1 = (int16)GET_TEMP(color_lut[idx - 1]) * CCT_TEMP_FACTOR;
-                y2 = (int16)GET_LEVEL(color_lut[idx]);
-                x2 = (int16)GET_TEMP(color_lut[idx]) * CCT_TEMP_FACTOR;
-
-                /* Apply Straight Line interpolation.
-                 * y = y1 + ((y2 - y1) * (x -x1))/(x2 - x1)
-                 */
-                val = ((int32)(y2 - y1))*((int16)temp - x1);
-                val = (val)/(x2 - x1) + y1;
-
-                /* return the calculated value */
-                return ((uint8)val);
-            }
+            ReportPanic(app_panic_level_lut);
         }
     }
+}
+#endif /* ENABLE_LEVEL_LUT_CHECK */
 
-    /* If temperature is greater than last element in LUT,
-     * saturate to the highest
-     */
-    return GET_LEVEL(color_lut[sizeof_lut - 1]);
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      scaleLevel
+ *
+ *  DESCRIPTION
+ *      This function scales a 0-255 colour level by a relative luminance of
+ *      the brightness look up table, keeping the 16 bit precision of the
+ *      table. The result is rounded up, so a non-zero colour level at a
+ *      non-zero brightness never turns the channel off, and a full luminance
+ *      of 65535 leaves the colour level unchanged.
+ *
+ * RETURNS
+ *      Scaled colour level as a 16 bit duty cycle.
+ *
+ *----------------------------------------------------------------------------*/
+static uint16 scaleLevel(uint8 colour, uint16 luminance)
+{
+    const uint32 round_up = (0x1UL << LEVEL_LUT_SHIFT) - 1;
+    const uint16 duty = ((uint16)colour << 8) | colour;
 
+    return (uint16)(((uint32)duty * luminance + round_up) >> LEVEL_LUT_SHIFT);
 }
-
-#endif /* COLOUR_TEMP_ENABLED */
+#endif /* GUNILAMP */
 
 /*============================================================================*
  *  Public function definitions
@@ -195,6 +300,9 @@ extern void LightHardwareInit(void)
 #ifdef GUNILAMP
     GuniLampInit();
 #else /* IOT Board */
+#ifdef ENABLE_LEVEL_LUT_CHECK
+    checkLevelLut();
+#endif /* ENABLE_LEVEL_LUT_CHECK */
     IOTLightControlDeviceInit();
 #endif
 }
@@ -284,15 +392,39 @@ extern void LightHardwareSetLevel(uint8 red, uint8 green, uint8 blue,
 #ifdef GUNILAMP
     GuniLampControl(red, green, blue, level);
 #else /* IOT Board */
-    /* The brightness level is represented through RGB values */
-    uint32 temp;
-    temp  = (uint32)(red * level)/255;
-    red = temp & 0xFF;
-    temp  = (uint32)(green * level)/255;
-    green = temp & 0xFF;
-    temp  = (uint32)(blue * level)/255;
-    blue = temp & 0xFF;
-    IOTLightControlDeviceSetColor(red, green, blue);
+    /* The brightness level is represented through RGB values, scaled by the
+     * perceived luminance of the level. They are passed on as 16 bit duty
+     * cycles, so the fast PWM can drive the dim levels in 12 bit resolution.
+     */
+    const uint16 luminance = level_lut[level];
+
+    IOTLightControlDeviceSetDuty(scaleLevel(red, luminance),
+                                 scaleLevel(green, luminance),
+                                 scaleLevel(blue, luminance));
+#endif
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      LightHardwareSetRampTime
+ *
+ *  DESCRIPTION
+ *      Sets the time over which the following colour and level changes are
+ *      faded in.
+ *
+ * PARAMETERS
+ *      ramp_time [in] Transition time in milliseconds, 0 for no transition.
+ *
+ * RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+extern void LightHardwareSetRampTime(uint16 ramp_time)
+{
+#ifdef GUNILAMP
+    /* Gunilamp applies colours straight away */
+#else /* IOT Board */
+    IOTLightControlDeviceSetRampTime(ramp_time);
 #endif
 }
 
@@ -314,13 +446,23 @@ extern void LightHardwareSetLevel(uint8 red, uint8 green, uint8 blue,
  *----------------------------------------------------------------------------*/
 extern bool LightHardwareSetColorTemp(uint16 temp)
 {
-    uint8  red, green, blue;
+    const CCT_LUT_ENTRY_T *entry;
+    uint16 idx = 0;
 
-    red   = getLevelFromCCTLut(temp, cct_red_lut, LUT_SIZE(cct_red_lut));
-    green = getLevelFromCCTLut(temp, cct_green_lut, LUT_SIZE(cct_green_lut));
-    blue  = getLevelFromCCTLut(temp, cct_blue_lut, LUT_SIZE(cct_blue_lut));
+    /* Round to the nearest entry and saturate at both ends of the table */
+    if (temp > CCT_LUT_MIN_TEMP)
+    {
+        idx = (temp - CCT_LUT_MIN_TEMP + (CCT_LUT_STEP / 2)) / CCT_LUT_STEP;
+        if (idx >= CCT_LUT_SIZE)
+        {
+            idx = CCT_LUT_SIZE - 1;
+        }
+    }
+    entry = &cct_lut[idx];
 
-    return LightHardwareSetColor(red, green, blue);
+    return LightHardwareSetColor(entry->red_green & 0xFF,
+                                 (entry->red_green >> 8) & 0xFF,
+                                 entry->blue);
 }
 #endif /* COLOUR_TEMP_ENABLED */    
 
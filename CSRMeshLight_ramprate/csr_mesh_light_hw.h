@@ -31,6 +31,9 @@ extern bool LightHardwareSetColor(uint8 red, uint8 green, uint8 blue);
 extern void LightHardwareSetLevel(uint8 red, uint8 green, uint8 blue, 
                                   uint8 level);
 
+/* Sets the time over which colour and level changes are faded in. */
+extern void LightHardwareSetRampTime(uint16 ramp_time);
+
 /* Controls the colour temperature. */
 extern bool LightHardwareSetColorTemp(uint16 temp);
 
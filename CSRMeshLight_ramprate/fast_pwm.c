@@ -21,6 +21,7 @@
 #include <pio.h>
 #include <pio_ctrlr.h>
 #include <sleep.h>
+#include <time.h>
 
 /*============================================================================*
  *  Local Header Files
@@ -30,37 +31,162 @@
 
 #ifdef ENABLE_FAST_PWM
 
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+/* Words of the memory shared with the PIO controller code. Each word holds
+ * two bytes of the PIO controller memory, the lower byte first.
+ */
+#define FAST_PWM_INIT_STATE_WORD    (8)
+#define FAST_PWM_BRIGHT_PERIOD_WORD (9)
+#define FAST_PWM_DULL_PERIOD_WORD   (10)
+#define FAST_PWM_RESET_WORD         (11)
+#define FAST_PWM_COMMIT_WORD        (12)
+#define FAST_PWM_STAGED_WIDTH_WORD  (13)
+#define FAST_PWM_STAGED_STATE_WORD  (21)
+#define FAST_PWM_STAGED_FRACTION_WORD (22)
+#define FAST_PWM_HIRES_WORD         (26)
+
+/* Offset between the bright and dull widths of a port, in words */
+#define FAST_PWM_DULL_WIDTH_OFFSET  (4)
+
+/* Number of width steps in a pulse, times the 16 fractions of a step of the
+ * high resolution mode.
+ */
+#define FAST_PWM_HIRES_SCALE        (255UL * 16)
+
+/* Longest wait for the PIO controller to apply the last committed widths.
+ * It applies them at the end of the current pulse, which lasts about 1.1 ms.
+ */
+#define FAST_PWM_COMMIT_TIMEOUT     (3 * MILLISECOND)
+
+/* Word of the memory shared with the PIO controller code */
+#define FAST_PWM_SHARED_WORD(word)  \
+                        (*(volatile uint16 *)(PIO_CONTROLLER_DATA_WORD + (word)))
+
 /* Included externally in PIO controller code.*/
 void pio_ctrlr_code(void);
+
 /*============================================================================*
- *  Public Function Implementations
+ *  Private Data
+ *============================================================================*/
+/* TRUE while the PIO controller is running */
+static bool fast_pwm_enabled = FALSE;
+
+/* PIOs driven by the PIO controller */
+static uint32 fast_pwm_pio_mask = 0;
+
+/* PWM ports set by PioFastPwmSetDuty to a fraction of a step, one bit per
+ * port. The high resolution mode is enabled while any is set.
+ */
+static uint16 fast_pwm_hires_ports = 0;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+/* Waits until the PIO controller has applied the last committed widths */
+static void waitForCommit(void);
+
+/* Stages the fraction of a step added to the bright width of a port */
+static void setFraction(uint8 pwm_port, uint8 fraction);
+
+/* Stages the bright/dull widths and the output state of a port */
+static void stageWidths(uint8 pwm_port, uint8 bright_width, uint8 dull_width,
+                        bool inverted);
+
+/* Enables the high resolution mode while any port has a fraction of a step */
+static void setHiresPort(uint8 pwm_port, bool hires);
+
+/*============================================================================*
+ *  Private Function Implementations
  *============================================================================*/
 /*----------------------------------------------------------------------------*
  *  NAME
- *      PioFastPwmSetWidth
+ *      waitForCommit
  *
  *  DESCRIPTION
- *      This function sets the required pulse width in multiples of 4us
- *      on a PWM port.
+ *      This function waits until the PIO controller has copied the last
+ *      committed widths, so that two commits are not merged into one. The
+ *      controller copies them at the end of the current pulse. A stopped
+ *      controller copies them when it starts, so there is nothing to wait
+ *      for. The wait gives up after FAST_PWM_COMMIT_TIMEOUT, in case the
+ *      controller is not running the PWM code.
  *
  *  RETURNS
  *      Nothing.
  *
  *----------------------------------------------------------------------------*/
- bool PioFastPwmSetWidth(uint8 pwm_port, uint8 bright_width, uint8 dull_width,
+static void waitForCommit(void)
+{
+    uint32 start = TimeGet32();
+
+    while(fast_pwm_enabled && FAST_PWM_SHARED_WORD(FAST_PWM_COMMIT_WORD) != 0 &&
+          TimeGet32() - start < FAST_PWM_COMMIT_TIMEOUT)
+    {
+        /* Wait for the end of the current pulse */
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      setFraction
+ *
+ *  DESCRIPTION
+ *      This function stages the 0-15 fraction of a 4us step added to the
+ *      bright width of a PWM port in the high resolution mode.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+static void setFraction(uint8 pwm_port, uint8 fraction)
+{
+    volatile uint16*address=&FAST_PWM_SHARED_WORD(
+                FAST_PWM_STAGED_FRACTION_WORD+((pwm_port-PWM0_PORT)>>1));
+
+    /* The controller accumulates the fraction in the upper nibble */
+    fraction=(fraction&0x0f)<<4;
+
+    if(pwm_port&1)
+    {
+        *address&=0x00ff;
+        *address|=(fraction<<8);
+    }
+    else
+    {
+        *address&=0xff00;
+        *address|=fraction;
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      stageWidths
+ *
+ *  DESCRIPTION
+ *      This function stages the bright and dull widths of a PWM port in
+ *      multiples of 4us, and whether its output is inverted. It is the first
+ *      write of the staged data of a port, so it first waits for the PIO
+ *      controller to copy the last commit, which would otherwise be torn.
+ *      Once the commit is copied, the next ports are staged without waiting.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+static void stageWidths(uint8 pwm_port, uint8 bright_width, uint8 dull_width,
                         bool inverted)
 {
-    if(pwm_port < PWM0_PORT || pwm_port > PWM7_PORT ||
-       bright_width > 255 || dull_width > 255)
-        return FALSE;
+    volatile uint16*address=&FAST_PWM_SHARED_WORD(FAST_PWM_STAGED_WIDTH_WORD+
+                                                   ((pwm_port-PWM0_PORT)>>1));
 
-    uint16*address=PIO_CONTROLLER_DATA_WORD+((pwm_port-PWM0_PORT)>>1);
+    waitForCommit();
 
     if(pwm_port&1)
     {
         *address&=0x00ff;
         *address|=(bright_width<<8);
-        address+=4;
+        address+=FAST_PWM_DULL_WIDTH_OFFSET;
         *address&=0x00ff;
         *address|=(dull_width<<8);
     }
@@ -68,27 +194,136 @@ void pio_ctrlr_code(void);
     {
         *address&=0xff00;
         *address|=bright_width;
-        address+=4;
+        address+=FAST_PWM_DULL_WIDTH_OFFSET;
         *address&=0xff00;
         *address|=dull_width;
     }
 
-    address=PIO_CONTROLLER_DATA_WORD+8;
+    address=&FAST_PWM_SHARED_WORD(FAST_PWM_STAGED_STATE_WORD);
 
     if(inverted)
         *address&=~(1<<(pwm_port-PWM0_PORT));
     else
         *address|=1<<(pwm_port-PWM0_PORT);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      setHiresPort
+ *
+ *  DESCRIPTION
+ *      This function records whether a PWM port has a fraction of a step,
+ *      and enables the high resolution mode of the PIO controller only while
+ *      any port has. A port set on a whole step is then not dithered, and
+ *      the controller does not dither from stale fractions.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+static void setHiresPort(uint8 pwm_port, bool hires)
+{
+    if(hires)
+        fast_pwm_hires_ports|=(uint16)0x1<<(pwm_port-PWM0_PORT);
+    else
+        fast_pwm_hires_ports&=~((uint16)0x1<<(pwm_port-PWM0_PORT));
+
+    FAST_PWM_SHARED_WORD(FAST_PWM_HIRES_WORD)=(fast_pwm_hires_ports!=0);
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      PioFastPwmSetWidth
+ *
+ *  DESCRIPTION
+ *      This function stages the required pulse width in multiples of 4us
+ *      on a PWM port. The staged widths of all the ports are applied
+ *      together by PioFastPwmCommit.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+ bool PioFastPwmSetWidth(uint8 pwm_port, uint8 bright_width, uint8 dull_width,
+                        bool inverted)
+{
+    if(pwm_port < PWM0_PORT || pwm_port > PWM7_PORT ||
+       bright_width > 255 || dull_width > 255)
+        return FALSE;
+
+    stageWidths(pwm_port, bright_width, dull_width, inverted);
+    setFraction(pwm_port, 0);
+    setHiresPort(pwm_port, FALSE);
+    return TRUE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      PioFastPwmSetDuty
+ *
+ *  DESCRIPTION
+ *      This function stages the duty cycle of a PWM port from 0 (off) to
+ *      0xFFFF (on for the whole pulse). The bright width of the port is
+ *      set in 1/16 of a 4us step, by making some of every 16 pulses one
+ *      step longer, which gives 12 bit duty cycles. The controller shortens the
+ *      dull width of those pulses by the same step, and every pulse lasts
+ *      the same time whatever the widths. The PIO controller only runs the
+ *      high resolution mode while a port has a fraction of a step, a duty
+ *      cycle on a whole step is driven as a plain width. The duty cycles of
+ *      all the ports are applied together by PioFastPwmCommit.
+ *
+ *  RETURNS
+ *      TRUE if the duty cycle was staged.
+ *
+ *----------------------------------------------------------------------------*/
+bool PioFastPwmSetDuty(uint8 pwm_port, uint16 duty, bool inverted)
+{
+    uint16 width;
+
+    if(pwm_port < PWM0_PORT || pwm_port > PWM7_PORT)
+        return FALSE;
+
+    /* Scale the duty cycle to 1/16 steps, rounding to nearest */
+    width=(uint16)(((uint32)duty*FAST_PWM_HIRES_SCALE+0x8000UL)>>16);
+
+    stageWidths(pwm_port, width>>4, 0xFF-(width>>4), inverted);
+    setFraction(pwm_port, width&0x0f);
+    setHiresPort(pwm_port, (width&0x0f)!=0);
     return TRUE;
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      PioFastPwmCommit
+ *
+ *  DESCRIPTION
+ *      This function requests the PIO controller to apply the staged widths
+ *      of all the PWM ports at the end of the current pulse, so that no
+ *      pulse is output with some ports updated and others not. The widths
+ *      are only staged once the last commit is applied, so the wait here
+ *      only applies to a commit with nothing staged since the last one.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *----------------------------------------------------------------------------*/
+void PioFastPwmCommit(void)
+{
+    waitForCommit();
+    FAST_PWM_SHARED_WORD(FAST_PWM_COMMIT_WORD)=1;
+}
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      PioFastPwmSetPeriods
  *
  *  DESCRIPTION
  *      This function sets bright and dull periods for PWM. This is
- *      applicable for all PWM ports enabled.
+ *      applicable for all PWM ports enabled. The PWM is restarted from the
+ *      bright period only if the periods change.
  *
  *  RETURNS
  *      Nothing.
@@ -96,9 +331,13 @@ void pio_ctrlr_code(void);
  *----------------------------------------------------------------------------*/
 void PioFastPwmSetPeriods(uint16 bright, uint16 dull)
 {
-    *(PIO_CONTROLLER_DATA_WORD+9)=bright;
-    *(PIO_CONTROLLER_DATA_WORD+10)=dull;
-    *(PIO_CONTROLLER_DATA_WORD+11)=1; /* reset */
+    if(FAST_PWM_SHARED_WORD(FAST_PWM_BRIGHT_PERIOD_WORD)==bright &&
+       FAST_PWM_SHARED_WORD(FAST_PWM_DULL_PERIOD_WORD)==dull)
+        return;
+
+    FAST_PWM_SHARED_WORD(FAST_PWM_BRIGHT_PERIOD_WORD)=bright;
+    FAST_PWM_SHARED_WORD(FAST_PWM_DULL_PERIOD_WORD)=dull;
+    FAST_PWM_SHARED_WORD(FAST_PWM_RESET_WORD)=1; /* reset */
 }
 
 /*----------------------------------------------------------------------------*
@@ -114,6 +353,8 @@ void PioFastPwmSetPeriods(uint16 bright, uint16 dull)
  *----------------------------------------------------------------------------*/
 void PioFastPwmConfig(uint32 pio_mask)
 {
+    fast_pwm_pio_mask=pio_mask;
+
     PioSetModes(pio_mask,  pio_mode_pio_controller);
     PioSetPullModes(pio_mask, pio_mode_no_pulls);
 
@@ -126,7 +367,12 @@ void PioFastPwmConfig(uint32 pio_mask)
  *      PioFastPwmEnable
  *
  *  DESCRIPTION
- *      This function enables/disables PWM.
+ *      This function enables/disables PWM. The PIOs are connected to the
+ *      PIO controller on enabling, in case they were used by the hardware
+ *      PWMs meanwhile. The PIO controller is left running if it is already
+ *      enabled. Disabling it lets the chip go back to deep sleep, and leaves
+ *      the PIOs to be connected elsewhere. The high resolution mode is
+ *      turned off until duty cycles are set again.
  *
  *  RETURNS
  *      Nothing.
@@ -134,6 +380,14 @@ void PioFastPwmConfig(uint32 pio_mask)
  *----------------------------------------------------------------------------*/
 void PioFastPwmEnable(bool enable)
 {
+    if(enable)
+        PioSetModes(fast_pwm_pio_mask, pio_mode_pio_controller);
+
+    if(enable==fast_pwm_enabled)
+        return;
+
+    fast_pwm_enabled=enable;
+
     if(enable)
     {
         SleepModeChange(sleep_mode_shallow);
@@ -143,6 +397,9 @@ void PioFastPwmEnable(bool enable)
     {
         PioCtrlrStop();
         SleepModeChange(sleep_mode_deep);
+
+        fast_pwm_hires_ports=0;
+        FAST_PWM_SHARED_WORD(FAST_PWM_HIRES_WORD)=0;
     }
 }
 #endif /* ENABLE_FAST_PWM */
@@ -36,10 +36,16 @@
 /* Configures a PWM port. */
 void PioFastPwmConfig(uint32 pio_mask);
 
-/* Sets the bright/dull widths for a PWM port. */
+/* Stages the bright/dull widths for a PWM port. */
 bool PioFastPwmSetWidth(uint8 pwm_port, uint8 bright_width, uint8 dull_width,
                         bool inverted);
 
+/* Stages the 16 bit duty cycle for a PWM port, in high resolution mode. */
+bool PioFastPwmSetDuty(uint8 pwm_port, uint16 duty, bool inverted);
+
+/* Applies the staged widths of all the PWM ports together. */
+void PioFastPwmCommit(void);
+
 /* Enable the PWM. */
 void PioFastPwmEnable(bool enable);
 
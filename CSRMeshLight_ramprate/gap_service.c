@@ -64,11 +64,6 @@ AD_TYPE_LOCAL_NAME_COMPLETE,
  *  Private Definitions
  *============================================================================*/
 
-/* Number of words of NVM memory used by GAP service */
-
-/* Add space for Device Name Length and Device Name */
-#define GAP_SERVICE_NVM_MEMORY_WORDS  (1 + DEVICE_NAME_MAX_LENGTH)
-
 /* The offset of data being stored in NVM for GAP service. This offset is 
  * added to GAP service offset to NVM region (see g_gap_data.nvm_offset) 
  * to get the absolute offset at which this data is stored in NVM
@@ -385,24 +380,3 @@ extern uint8 *GapGetNameAndLength(uint16 *p_name_length)
     *p_name_length = StrLen((char *)g_device_name);
     return (g_device_name);
 }
-
-#ifdef NVM_TYPE_FLASH
-/*----------------------------------------------------------------------------*
- *  NAME
- *      WriteGapServiceDataInNVM
- *
- *  DESCRIPTION
- *      This function writes the GAP service data in NVM
- *
- *  RETURNS
- *      Nothing
- *
- *---------------------------------------------------------------------------*/
-
-extern void WriteGapServiceDataInNVM(void)
-{
-    /* Gap Service has only device name to write into NVM */
-    gapWriteDeviceNameToNvm();
-}
-#endif /* NVM_TYPE_FLASH */
-
@@ -27,6 +27,15 @@
 
 #include "gap_conn_params.h"
 
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Number of words of NVM memory used by GAP service */
+
+/* Add space for Device Name Length and Device Name */
+#define GAP_SERVICE_NVM_MEMORY_WORDS  (1 + DEVICE_NAME_MAX_LENGTH)
+
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -62,9 +71,4 @@ extern bool GapCheckHandleRange(uint16 handle);
  */
 extern uint8 *GapGetNameAndLength(uint16 *p_name_length);
 
-#ifdef NVM_TYPE_FLASH
-/* This function writes the GAP service data in NVM */
-extern void WriteGapServiceDataInNVM(void);
-#endif /* NVM_TYPE_FLASH */
-
 #endif /* __GAP_SERVICE_H__ */
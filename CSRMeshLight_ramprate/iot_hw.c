@@ -16,6 +16,8 @@
  *============================================================================*/
 
 #include <pio.h>            /* Programmable I/O configuration and control */
+#include <timer.h>          /* Chip timer functions */
+#include <time.h>           /* Chip time functions */
 
 /*============================================================================*
  *  Local Header Files
@@ -23,7 +25,7 @@
 #include "user_config.h"
 #include "iot_hw.h"
 #include "fast_pwm.h"
-#include "time.h"
+#include "light_ramp.h"
 
 /*============================================================================*
  *  Private data
@@ -38,6 +40,561 @@
 /* Maximum colour level supported by mapped colour depth bits. */
 #define COLOR_MAX_VALUE          ((0x1 << LIGHT_MAPPED_COLOR_DEPTH) - 1)
 
+/* Default duration of a colour transition in milliseconds. */
+#define RAMP_DEFAULT_TIME_MS     (128)
+
+/* Number of colour channels driven by the hardware PWMs. */
+#define LED_PWM_CHANNELS         (3)
+
+/* Part of a 0-255 colour level below the hardware colour depth */
+#define LEVEL_FRACTION_MASK      ((0x1 << QUANTIZATION_ERROR) - 1)
+
+/* 16 bit duty cycle of a 0-255 colour level */
+#define LEVEL_TO_DUTY(level)     (((uint16)(level) << 8) | (level))
+
+/* Mapped colour level forcing the next level to be written to the PWM. */
+#define RAMP_MAPPED_INVALID      (0xFF)
+
+/* Interval between two consecutive steps of the colour ramp. */
+#define RAMP_STEP_INTERVAL_MS    (8)
+#define RAMP_STEP_INTERVAL       (RAMP_STEP_INTERVAL_MS * MILLISECOND)
+
+/* Colour ramp of the PWMs, in 16 bit duty cycles. Channels are indexed by
+ * LED_PWM_x.
+ */
+static LIGHT_RAMP_T light_ramp;
+
+/* Mapped colour level last written to each PWM, indexed by LED_PWM_x */
+static uint8 pwm_mapped[LED_PWM_CHANNELS];
+
+/* Timer driving the colour ramp. Valid only while a ramp is in progress. */
+static timer_id ramp_tid = TIMER_INVALID;
+
+/* PIO connected to each PWM, indexed by LED_PWM_x */
+static const uint8 pwm_pio[LED_PWM_CHANNELS] =
+                            {LED_PIO_RED, LED_PIO_GREEN, LED_PIO_BLUE};
+
+#ifdef ENABLE_FAST_PWM
+/* TRUE while the LEDs are driven by the PIO controller rather than the
+ * hardware PWMs.
+ */
+static bool fast_pwm_selected = FALSE;
+
+/* TRUE while the PIO controller blinks the LEDs, until a colour is driven
+ * again or the PIO controller is stopped.
+ */
+static bool fast_pwm_blinking = FALSE;
+#endif /* ENABLE_FAST_PWM */
+
+#ifdef ENABLE_PWM_DITHERING
+/* Number of PWM frames in a dither cycle, one per pattern bit */
+#define DITHER_FRAMES            (16)
+
+/* Duration of a dither frame, 625 us. A full cycle lasts DITHER_FRAMES
+ * frames, 10 ms, so a level driven on a single frame of the cycle still
+ * flickers at 100 Hz, above flicker fusion.
+ */
+#define DITHER_FRAME_INTERVAL    (MILLISECOND * 5 / 8)
+
+/* Dither patterns indexed by the fraction of a level lost by re-quantization.
+ * Bit n is set if the next mapped level is driven during frame n. The set
+ * bits are spread evenly over the cycle so the flicker stays at the highest
+ * possible frequency, and their count matches the fraction, so the mapped
+ * level averaged over a cycle is the 0-255 level divided by 16.
+ */
+static const uint16 dither_pattern[DITHER_FRAMES] =
+{
+    0x0000, 0x8000, 0x8080, 0x8420, 0x8888, 0x9248, 0xA4A4, 0xAA54,
+    0xAAAA, 0xD5AA, 0xDADA, 0xEDB6, 0xEEEE, 0xFBDE, 0xFEFE, 0xFFFE
+};
+
+/* 0-255 colour level driven on each PWM, indexed by LED_PWM_x */
+static uint8 pwm_level[LED_PWM_CHANNELS];
+
+/* Current frame of the dither cycle */
+static uint8 dither_frame;
+
+/* Timer driving the dither frames. Valid only while a PWM is dithered. */
+static timer_id dither_tid = TIMER_INVALID;
+
+/* Number of dither frames processed so far */
+static uint32 dither_frame_count;
+
+/* Time spent processing dither frames so far, in microseconds */
+static uint32 dither_busy_time;
+#endif /* ENABLE_PWM_DITHERING */
+
+/* Duration of a colour transition in milliseconds */
+static uint16 ramp_time_ms = RAMP_DEFAULT_TIME_MS;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+/* Returns TRUE if the hardware PWMs drive a colour level exactly */
+static bool isMappedLevel(uint8 level);
+
+/* Returns the 0-255 colour level of a 16 bit duty cycle */
+static uint8 dutyToLevel(uint16 duty);
+
+/* Drives a mapped colour level on one of the LED PWMs */
+static void driveChannel(uint8 pwm, uint8 mapped);
+
+/* Drives a colour level on one of the LED PWMs */
+static void applyChannelLevel(uint8 pwm, uint8 level);
+
+/* Drives the current colour of the ramp on the LEDs */
+static void driveColour(void);
+
+#ifdef ENABLE_FAST_PWM
+/* Returns TRUE if the current colour needs the PIO controller */
+static bool needsFastPwm(void);
+
+/* Hands the LEDs over to the PIO controller */
+static void selectFastPwm(void);
+
+/* Hands the LEDs over to the hardware PWMs */
+static void selectHardwarePwm(void);
+#endif /* ENABLE_FAST_PWM */
+
+#ifdef ENABLE_PWM_DITHERING
+/* Returns the mapped level to drive for a colour level in the current frame */
+static uint8 ditheredLevel(uint8 level);
+
+/* Dither frame timer handler */
+static void ditherTimerHandler(timer_id tid);
+
+/* Stops dithering the PWMs */
+static void ditherStop(void);
+#endif /* ENABLE_PWM_DITHERING */
+
+/* Colour ramp timer handler */
+static void rampTimerHandler(timer_id tid);
+
+/* Stops the colour ramp and drives the target colour straight away */
+static void rampComplete(void);
+
+/* Stops the colour ramp on the colour currently driven */
+static void rampStop(void);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      isMappedLevel
+ *
+ *  DESCRIPTION
+ *      This function checks whether a 0-255 colour level is driven exactly
+ *      by the hardware PWMs, that is it has no fraction below the colour
+ *      depth of the hardware. The levels above the highest mapped level are
+ *      clipped to it, which is close enough.
+ *
+ *  RETURNS
+ *      TRUE if the level is driven exactly.
+ *
+ *---------------------------------------------------------------------------*/
+static bool isMappedLevel(uint8 level)
+{
+    return ((level & LEVEL_FRACTION_MASK) == 0 ||
+            (level >> QUANTIZATION_ERROR) == COLOR_MAX_VALUE);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      dutyToLevel
+ *
+ *  DESCRIPTION
+ *      This function converts a 16 bit duty cycle of the ramp to the 0-255
+ *      colour level driven by the hardware PWMs. The result is rounded up,
+ *      so a non-zero duty cycle never turns the channel off, and the duty
+ *      cycle of a colour level converts back to that level.
+ *
+ *  RETURNS
+ *      0-255 colour level.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8 dutyToLevel(uint16 duty)
+{
+    return (uint8)(((uint32)duty * 0xFF + 0xFFFF) >> 16);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      driveChannel
+ *
+ *  DESCRIPTION
+ *      This function drives a colour level, already mapped to the colour
+ *      depth of the hardware, on one of the LED PWMs if it differs from the
+ *      one already driven. When the mapped level is zero the PWM is
+ *      disconnected to avoid flicker.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void driveChannel(uint8 pwm, uint8 mapped)
+{
+    /* PIO mode connected to each PWM, indexed by LED_PWM_x */
+    static const pio_mode pwm_mode[LED_PWM_CHANNELS] =
+                            {pio_mode_pwm0, pio_mode_pwm1, pio_mode_pwm2};
+    uint8 inverted;
+
+    if (mapped == pwm_mapped[pwm])
+    {
+        return;
+    }
+    pwm_mapped[pwm] = mapped;
+
+    if (mapped == 0)
+    {
+        PioSetMode(pwm_pio[pwm], pio_mode_user);
+        PioSet(pwm_pio[pwm], 1);
+    }
+    else
+    {
+        /* Invert value as its a pull down */
+        inverted = COLOR_MAX_VALUE - mapped;
+
+        PioSetMode(pwm_pio[pwm], pwm_mode[pwm]);
+        PioConfigPWM(pwm, pio_pwm_mode_push_pull,
+                     inverted, (COLOR_MAX_VALUE - inverted), 1U,
+                     inverted, (COLOR_MAX_VALUE - inverted), 1U, 0U);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      applyChannelLevel
+ *
+ *  DESCRIPTION
+ *      This function re-quantizes a 0-255 colour level to the colour depth
+ *      of the hardware and drives it on one of the LED PWMs. With dithering
+ *      enabled the level lost by re-quantization is recovered by alternating
+ *      the two nearest mapped levels over the frames of the dither cycle.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void applyChannelLevel(uint8 pwm, uint8 level)
+{
+#ifdef ENABLE_PWM_DITHERING
+    pwm_level[pwm] = level;
+    driveChannel(pwm, ditheredLevel(level));
+
+    if (!isMappedLevel(level) && dither_tid == TIMER_INVALID)
+    {
+        dither_tid = TimerCreate(DITHER_FRAME_INTERVAL, TRUE,
+                                 ditherTimerHandler);
+    }
+#else
+    driveChannel(pwm, level >> QUANTIZATION_ERROR);
+#endif /* ENABLE_PWM_DITHERING */
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      driveColour
+ *
+ *  DESCRIPTION
+ *      This function drives the current colour of the ramp on the LEDs. With
+ *      fast PWM enabled, the PIO controller drives the ramps and the colours
+ *      the hardware PWMs cannot drive exactly. It keeps the chip in shallow
+ *      sleep, so the hardware PWMs drive all the other colours and let the
+ *      chip go to deep sleep.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void driveColour(void)
+{
+    uint8 pwm;
+#ifdef ENABLE_FAST_PWM
+    if (needsFastPwm())
+    {
+        selectFastPwm();
+        fast_pwm_blinking = FALSE;
+
+        /* The PIO controller drives the duty cycles in 12 bit resolution */
+        for (pwm = 0; pwm < LED_PWM_CHANNELS; pwm++)
+        {
+            PioFastPwmSetDuty(pwm_pio[pwm], light_ramp.channel[pwm].current,
+                              TRUE);
+        }
+        PioFastPwmCommit();
+
+        /* Only restarts the PWM if it was left blinking */
+        PioFastPwmSetPeriods(1, 0);
+        PioFastPwmEnable(TRUE);
+        return;
+    }
+
+    selectHardwarePwm();
+#endif /* ENABLE_FAST_PWM */
+
+    for (pwm = 0; pwm < LED_PWM_CHANNELS; pwm++)
+    {
+        applyChannelLevel(pwm, dutyToLevel(light_ramp.channel[pwm].current));
+    }
+}
+
+#ifdef ENABLE_FAST_PWM
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      needsFastPwm
+ *
+ *  DESCRIPTION
+ *      This function checks whether the current colour needs the PIO
+ *      controller, because it is ramping or because one of its duty cycles
+ *      is not a colour level or falls between two levels of the hardware
+ *      PWMs.
+ *
+ *  RETURNS
+ *      TRUE if the current colour needs the PIO controller.
+ *
+ *---------------------------------------------------------------------------*/
+static bool needsFastPwm(void)
+{
+    uint16 duty;
+    uint8 pwm;
+
+    if (LightRampInProgress(&light_ramp))
+    {
+        return TRUE;
+    }
+
+    for (pwm = 0; pwm < LED_PWM_CHANNELS; pwm++)
+    {
+        duty = light_ramp.channel[pwm].current;
+        if (duty != LEVEL_TO_DUTY(duty & 0xFF) || !isMappedLevel(duty & 0xFF))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      selectFastPwm
+ *
+ *  DESCRIPTION
+ *      This function hands the LEDs over to the PIO controller, if the
+ *      hardware PWMs drive them.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void selectFastPwm(void)
+{
+    uint8 pwm;
+
+    if (!fast_pwm_selected)
+    {
+        fast_pwm_selected = TRUE;
+#ifdef ENABLE_PWM_DITHERING
+        ditherStop();
+#endif /* ENABLE_PWM_DITHERING */
+
+        /* The PIO controller takes the PIOs over from the PWMs, so the
+         * levels need to be written again when the PWMs get them back.
+         */
+        for (pwm = 0; pwm < LED_PWM_CHANNELS; pwm++)
+        {
+            pwm_mapped[pwm] = RAMP_MAPPED_INVALID;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      selectHardwarePwm
+ *
+ *  DESCRIPTION
+ *      This function stops the PIO controller, if it drives the LEDs, which
+ *      lets the chip go back to deep sleep. The hardware PWMs take the PIOs
+ *      over as their levels are written.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void selectHardwarePwm(void)
+{
+    if (fast_pwm_selected)
+    {
+        fast_pwm_selected = FALSE;
+        fast_pwm_blinking = FALSE;
+        PioFastPwmEnable(FALSE);
+    }
+}
+#endif /* ENABLE_FAST_PWM */
+
+#ifdef ENABLE_PWM_DITHERING
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ditheredLevel
+ *
+ *  DESCRIPTION
+ *      This function returns the mapped level to drive for a 0-255 colour
+ *      level in the current frame of the dither cycle.
+ *
+ *  RETURNS
+ *      Mapped colour level.
+ *
+ *---------------------------------------------------------------------------*/
+static uint8 ditheredLevel(uint8 level)
+{
+    uint8 mapped = level >> QUANTIZATION_ERROR;
+
+    if (!isMappedLevel(level) &&
+        (dither_pattern[level & LEVEL_FRACTION_MASK] >> dither_frame) & 0x1)
+    {
+        mapped++;
+    }
+
+    return mapped;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ditherTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function moves to the next frame of the dither cycle, drives the
+ *      mapped levels of that frame and restarts the dither timer as long as
+ *      any PWM needs to be dithered. Only the PWMs whose mapped level changes
+ *      are reconfigured. The number of frames and the time spent on them are
+ *      accumulated to measure the CPU cost of dithering.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void ditherTimerHandler(timer_id tid)
+{
+    uint32 start_time;
+    bool   dithering = FALSE;
+    uint8  pwm;
+
+    if (tid == dither_tid)
+    {
+        dither_tid = TIMER_INVALID;
+        start_time = TimeGet32();
+
+        dither_frame = (dither_frame + 1) & (DITHER_FRAMES - 1);
+
+        for (pwm = 0; pwm < LED_PWM_CHANNELS; pwm++)
+        {
+            driveChannel(pwm, ditheredLevel(pwm_level[pwm]));
+            if (!isMappedLevel(pwm_level[pwm]))
+            {
+                dithering = TRUE;
+            }
+        }
+
+        if (dithering)
+        {
+            dither_tid = TimerCreate(DITHER_FRAME_INTERVAL, TRUE,
+                                     ditherTimerHandler);
+        }
+
+        dither_frame_count++;
+        dither_busy_time += TimeGet32() - start_time;
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ditherStop
+ *
+ *  DESCRIPTION
+ *      This function stops dithering the PWMs, leaving them on the mapped
+ *      levels of the current frame.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void ditherStop(void)
+{
+    TimerDelete(dither_tid);
+    dither_tid = TIMER_INVALID;
+}
+#endif /* ENABLE_PWM_DITHERING */
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      rampTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function advances every channel by one tick of the current
+ *      transition and restarts the ramp timer until the transition is over.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void rampTimerHandler(timer_id tid)
+{
+    if (tid == ramp_tid)
+    {
+        ramp_tid = TIMER_INVALID;
+
+        if (LightRampStep(&light_ramp))
+        {
+            ramp_tid = TimerCreate(RAMP_STEP_INTERVAL, TRUE, rampTimerHandler);
+        }
+
+        driveColour();
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      rampComplete
+ *
+ *  DESCRIPTION
+ *      This function stops any colour ramp in progress and drives the target
+ *      colour straight away.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void rampComplete(void)
+{
+    TimerDelete(ramp_tid);
+    ramp_tid = TIMER_INVALID;
+
+    LightRampComplete(&light_ramp);
+    driveColour();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      rampStop
+ *
+ *  DESCRIPTION
+ *      This function stops any colour ramp in progress, leaving the colour
+ *      currently driven.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void rampStop(void)
+{
+    TimerDelete(ramp_tid);
+    ramp_tid = TIMER_INVALID;
+
+    LightRampStop(&light_ramp);
+}
+
 /*============================================================================*
  *  Public Function Implementations
  *============================================================================*/
@@ -60,8 +617,8 @@ extern void IOTLightControlDeviceInit(void)
     PioFastPwmConfig(PIO_BIT_MASK(LED_PIO_RED) | \
                      PIO_BIT_MASK(LED_PIO_GREEN) | \
                      PIO_BIT_MASK(LED_PIO_BLUE));
+#endif /* ENABLE_FAST_PWM */
 
-#else
     /* Configure the LED_PIO_RED PIO as output PIO */
     PioSetDir(LED_PIO_RED, PIO_DIRECTION_OUTPUT);
 
@@ -70,7 +627,6 @@ extern void IOTLightControlDeviceInit(void)
 
     /* Configure the LED_PIO_BLUE PIO as output PIO */
     PioSetDir(LED_PIO_BLUE, PIO_DIRECTION_OUTPUT);
-#endif /* ENABLE_FAST_PWM */
 }
 
 /*----------------------------------------------------------------------------*
@@ -78,7 +634,8 @@ extern void IOTLightControlDeviceInit(void)
  *      IOTLightControlDevicePower
  *
  *  DESCRIPTION
- *      This function sets power state of LED.
+ *      This function sets power state of LED. The LEDs are driven by the
+ *      hardware PWMs or the PIO controller, depending on the colour.
  *
  *  RETURNS
  *      Nothing.
@@ -86,29 +643,48 @@ extern void IOTLightControlDeviceInit(void)
  *---------------------------------------------------------------------------*/
 extern void IOTLightControlDevicePower(bool power_on)
 {
-#ifdef ENABLE_FAST_PWM
-    PioFastPwmEnable(power_on);
-#else
+    uint8 pwm;
+
     if (power_on == TRUE)
     {
-        /* Configure the LED's */
-
-        /* Connect PWM0 output to LED_PIO_RED */
-        PioSetMode(LED_PIO_RED, pio_mode_pwm0);
-
-        /* Connect PWM1 output to LED_PIO_GREEN */
-        PioSetMode(LED_PIO_GREEN, pio_mode_pwm1);
-
-         /* Connect PWM2 output to LED_PIO_BLUE */
-        PioSetMode(LED_PIO_BLUE, pio_mode_pwm2);
-
         /* Enable the PIO's */
         PioEnablePWM(LED_PWM_RED, TRUE);
         PioEnablePWM(LED_PWM_GREEN, TRUE);
         PioEnablePWM(LED_PWM_BLUE, TRUE);
+
+#ifdef ENABLE_FAST_PWM
+        /* A blink keeps the PIO controller, and the light was not off, so
+         * leave it running rather than drive the colour over it.
+         */
+        if (fast_pwm_blinking)
+        {
+            return;
+        }
+#endif /* ENABLE_FAST_PWM */
+
+        /* The PIOs have been disconnected from the PWMs while the light was
+         * off, so drive the current levels again. This connects each LED to
+         * its PWM, or to the PIO controller.
+         */
+        for (pwm = 0; pwm < LED_PWM_CHANNELS; pwm++)
+        {
+            pwm_mapped[pwm] = RAMP_MAPPED_INVALID;
+        }
+        driveColour();
     }
     else
     {
+         /* Stop any colour ramp in progress, so that it does not re-connect
+          * the PWMs once the light is off.
+          */
+         rampStop();
+#ifdef ENABLE_PWM_DITHERING
+         ditherStop();
+#endif /* ENABLE_PWM_DITHERING */
+#ifdef ENABLE_FAST_PWM
+         selectHardwarePwm();
+#endif /* ENABLE_FAST_PWM */
+
          /* When power off is selected, disable all PWMs and
           * set all PIOs to HIGH, as IOT board uses common anode LED.
           */
@@ -120,7 +696,6 @@ extern void IOTLightControlDevicePower(bool power_on)
          PioSet(LED_PIO_GREEN, 1);
          PioSet(LED_PIO_BLUE, 1);
     }
-#endif /* ENABLE_FAST_PWM */
 }
 
 /*----------------------------------------------------------------------------*
@@ -155,100 +730,94 @@ extern void IOTLightControlDeviceSetLevel(uint8 level)
  *---------------------------------------------------------------------------*/
 extern void IOTLightControlDeviceSetColor(uint8 red, uint8 green, uint8 blue)
 {
-    static uint8 redl=0,greenl=0,bluel=0;
-    uint8 i=0;
-#ifdef ENABLE_FAST_PWM
-    PioFastPwmSetWidth(LED_PIO_RED, red, 0xFF - red, TRUE);
-    PioFastPwmSetWidth(LED_PIO_GREEN, green, 0xFF - green, TRUE);
-    PioFastPwmSetWidth(LED_PIO_BLUE, blue, 0xFF - blue, TRUE);
-    PioFastPwmSetPeriods(1, 0);
-    PioFastPwmEnable(TRUE);
-#else
-    /* When level is Lowest (0-3) simply disable PWM to avoid flicker */
-    if ((red >> QUANTIZATION_ERROR) == 0)
-    {
-         PioSetMode(LED_PIO_RED, pio_mode_user);
-         PioSet(LED_PIO_RED, 1);
-    }
-    else
-    {
-        PioSetMode(LED_PIO_RED, pio_mode_pwm0);
-    }
+    IOTLightControlDeviceSetDuty(LEVEL_TO_DUTY(red), LEVEL_TO_DUTY(green),
+                                 LEVEL_TO_DUTY(blue));
+}
 
-    if ((green >> QUANTIZATION_ERROR) == 0)
-    {
-         PioSetMode(LED_PIO_GREEN, pio_mode_user);
-         PioSet(LED_PIO_GREEN, 1);
-    }
-    else
-    {
-        PioSetMode(LED_PIO_GREEN, pio_mode_pwm1);
-    }
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IOTLightControlDeviceSetDuty
+ *
+ *  DESCRIPTION
+ *      This function sets the colour as 16 bit duty cycles of the Red, Green
+ *      and Blue LEDs, from 0 (off) to 0xFFFF (fully on). The PIO controller
+ *      drives them in 12 bit resolution, the hardware PWMs as 0-255 colour
+ *      levels. All the channels are ramped from the current colour over the
+ *      configured ramp time by the ramp timer, so this function returns
+ *      without waiting for the ramp.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void IOTLightControlDeviceSetDuty(uint16 red, uint16 green, uint16 blue)
+{
+    /* Retarget the ramp from the levels currently driven. The ramp object
+     * only needs the new target, so a burst of colour changes costs the same
+     * as a single one, and the light never lags the last colour set by more
+     * than the ramp time.
+     */
+    LightRampRetarget(&light_ramp, red, green, blue,
+                      ramp_time_ms / RAMP_STEP_INTERVAL_MS);
 
-    if ((blue >> QUANTIZATION_ERROR) == 0)
-    {
-         PioSetMode(LED_PIO_BLUE, pio_mode_user);
-         PioSet(LED_PIO_BLUE, 1);
-    }
-    else
+    /* A colour applied without ramping, or one that moves no channel, ends
+     * any ramp in progress. This stops the ramp timer, and the PIO
+     * controller is no longer kept running for the ramp.
+     */
+    if (!LightRampInProgress(&light_ramp))
     {
-        PioSetMode(LED_PIO_BLUE, pio_mode_pwm2);
+        rampComplete();
+        return;
     }
 
-    /* Invert values as its a pull down */
-    red   = COLOR_MAX_VALUE - (red >> QUANTIZATION_ERROR);
-    green = COLOR_MAX_VALUE - (green >> QUANTIZATION_ERROR);
-    blue  = COLOR_MAX_VALUE - (blue >> QUANTIZATION_ERROR);
-    if(redl>red)
+    /* Start the ramp timer unless it is already running, in which case the
+     * next tick moves towards the new target.
+     */
+    if (ramp_tid == TIMER_INVALID)
     {
-        for(i=redl;i>red;i=i-2)
-        {        
-            PioConfigPWM(LED_PWM_RED, pio_pwm_mode_push_pull,
-                      i, (COLOR_MAX_VALUE - i), 1U,
-                      i, (COLOR_MAX_VALUE - i), 1U, 0U);
-            TimeDelayUSec(8000);
-        }       
+        ramp_tid = TimerCreate(RAMP_STEP_INTERVAL, TRUE, rampTimerHandler);
     }
-    else
-    {
-        for(i=redl;i<red;i=i+2)
-        {
-              PioConfigPWM(LED_PWM_RED, pio_pwm_mode_push_pull,
-                      i, (COLOR_MAX_VALUE - i), 1U,
-                      i, (COLOR_MAX_VALUE - i), 1U, 0U);
-              TimeDelayUSec(8000);          
-        }
-     }
-   
-    PioConfigPWM(LED_PWM_GREEN, pio_pwm_mode_push_pull,
-		green, (COLOR_MAX_VALUE - green), 1U,
-		green, (COLOR_MAX_VALUE - green), 1U, 0U);
-   if(bluel>blue)
-	{
-		for(i=bluel;i>blue;i--)
-		{
-			PioConfigPWM(LED_PWM_BLUE, pio_pwm_mode_push_pull,
-					i, (COLOR_MAX_VALUE - i), 1U,
-					i, (COLOR_MAX_VALUE - i), 1U, 0U);
-			TimeDelayUSec(8000);
-		}
-	}
-	else
-	{
-		for(i=bluel;i<blue;i++)
-		{
-			PioConfigPWM(LED_PWM_BLUE, pio_pwm_mode_push_pull,
-					i, (COLOR_MAX_VALUE - i), 1U,
-					i, (COLOR_MAX_VALUE - i), 1U, 0U);
-			TimeDelayUSec(8000);
-		}
-	}
-    redl = red;
-    greenl = green;
-    bluel = blue;
-#endif /* ENABLE_FAST_PWM */
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IOTLightControlDeviceSetRampTime
+ *
+ *  DESCRIPTION
+ *      This function sets the duration of the following colour transitions.
+ *      Zero applies new colours straight away.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void IOTLightControlDeviceSetRampTime(uint16 ramp_time)
+{
+    ramp_time_ms = ramp_time;
+}
+
+#ifdef ENABLE_PWM_DITHERING
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IOTLightControlDeviceGetDitherLoad
+ *
+ *  DESCRIPTION
+ *      This function returns the number of dither frames processed and the
+ *      time spent processing them since the device was reset. Dividing the
+ *      time by the duration of the frames gives the CPU load of dithering.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void IOTLightControlDeviceGetDitherLoad(uint32 *frames,
+                                               uint32 *busy_time)
+{
+    *frames = dither_frame_count;
+    *busy_time = dither_busy_time;
+}
+#endif /* ENABLE_PWM_DITHERING */
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      IOTLightControlDeviceBlink
@@ -263,16 +832,33 @@ extern void IOTLightControlDeviceSetColor(uint8 red, uint8 green, uint8 blue)
 extern void IOTLightControlDeviceBlink(uint8 red, uint8 green, uint8 blue,
                                        uint8 on_time, uint8 off_time)
 {
-#ifdef ENABLE_FAST_PWM    
+#ifdef ENABLE_FAST_PWM
+    /* Blinking is an effect of the PIO controller, which the colour ramp
+     * must not override.
+     */
+    rampStop();
+    selectFastPwm();
+
     PioFastPwmSetWidth(LED_PIO_RED, red, 0, TRUE);
     PioFastPwmSetWidth(LED_PIO_GREEN, green, 0, TRUE);
     PioFastPwmSetWidth(LED_PIO_BLUE, blue, 0, TRUE);
+    PioFastPwmCommit();
     PioFastPwmSetPeriods((on_time << 4), (off_time << 4));
     PioFastPwmEnable(TRUE);
+    fast_pwm_blinking = TRUE;
 #else
+    uint8 pwm;
+
     IOTLightControlDevicePower(TRUE);
 
+    /* Blinking is configured on top of the colour, so apply it without
+     * ramping.
+     */
     IOTLightControlDeviceSetColor(red, green, blue);
+    rampComplete();
+#ifdef ENABLE_PWM_DITHERING
+    ditherStop();
+#endif /* ENABLE_PWM_DITHERING */
 
     /* Invert the On and Off times as LEDs on
      * IOT board are Common-Anode type
@@ -285,6 +871,14 @@ extern void IOTLightControlDeviceBlink(uint8 red, uint8 green, uint8 blue,
 
     PioConfigPWM(LED_PWM_BLUE, pio_pwm_mode_push_pull,
                  blue, 0, off_time, 0, blue, on_time, 0U);
+
+    /* The PWMs no longer drive the mapped levels, so make sure the next
+     * colour is written to all of them.
+     */
+    for (pwm = 0; pwm < LED_PWM_CHANNELS; pwm++)
+    {
+        pwm_mapped[pwm] = RAMP_MAPPED_INVALID;
+    }
 #endif /* ENABLE_FAST_PWM */
 }
 
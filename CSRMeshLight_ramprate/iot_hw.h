@@ -65,6 +65,18 @@ extern void IOTLightControlDeviceSetLevel(uint8 level);
 /* This function sets the colour as per RGB values. */
 extern void IOTLightControlDeviceSetColor(uint8 red, uint8 green, uint8 blue);
 
+/* This function sets the colour as 16 bit duty cycles. */
+extern void IOTLightControlDeviceSetDuty(uint16 red, uint16 green, uint16 blue);
+
+/* This function sets the duration of the colour transitions. */
+extern void IOTLightControlDeviceSetRampTime(uint16 ramp_time);
+
+#ifdef ENABLE_PWM_DITHERING
+/* This function returns the CPU time spent dithering the PWMs. */
+extern void IOTLightControlDeviceGetDitherLoad(uint32 *frames,
+                                               uint32 *busy_time);
+#endif /* ENABLE_PWM_DITHERING */
+
 /* This function sets the Power State of Light. */
 extern void IOTLightControlDevicePower(bool power_on);
 
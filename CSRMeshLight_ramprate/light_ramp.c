@@ -0,0 +1,178 @@
+/******************************************************************************
+ *  Copyright Cambridge Silicon Radio Limited 2015
+ *  CSR Bluetooth Low Energy CSRmesh 1.3 Release
+ *  Application version 1.3
+ *
+ *  FILE
+ *      light_ramp.c
+ *
+ *  DESCRIPTION
+ *      This file implements the colour ramp used to fade the light between
+ *      two colours. The ramp only keeps track of the levels; it is ticked
+ *      and written to the hardware by the light controller.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+#include "light_ramp.h"
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      LightRampRetarget
+ *
+ *  DESCRIPTION
+ *      This function starts a transition from the levels currently reached
+ *      to a new target colour, spread over the given number of ticks. If a
+ *      transition is already in progress it is abandoned where it is, so a
+ *      new colour never restarts from a stale start point. The distance of
+ *      each channel is split in a whole step and a remainder here, so that
+ *      the ticks only need additions. If no channel moves, the transition
+ *      completes straight away rather than ticking for nothing.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void LightRampRetarget(LIGHT_RAMP_T *ramp, uint16 red, uint16 green,
+                              uint16 blue, uint16 steps)
+{
+    LIGHT_RAMP_CHANNEL_T *channel;
+    uint16 distance;
+    bool moving = FALSE;
+    uint8 idx;
+
+    ramp->channel[LIGHT_RAMP_RED].target   = red;
+    ramp->channel[LIGHT_RAMP_GREEN].target = green;
+    ramp->channel[LIGHT_RAMP_BLUE].target  = blue;
+
+    if (steps == 0)
+    {
+        LightRampComplete(ramp);
+        return;
+    }
+
+    for (idx = 0; idx < LIGHT_RAMP_CHANNELS; idx++)
+    {
+        channel = &ramp->channel[idx];
+
+        channel->falling = (channel->target < channel->current);
+        distance = channel->falling ? (channel->current - channel->target) :
+                                      (channel->target - channel->current);
+        channel->step      = distance / steps;
+        channel->remainder = distance % steps;
+        channel->error     = 0;
+
+        if (distance != 0)
+        {
+            moving = TRUE;
+        }
+    }
+
+    if (!moving)
+    {
+        LightRampComplete(ramp);
+        return;
+    }
+
+    ramp->steps = steps;
+    ramp->steps_left = steps;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      LightRampStep
+ *
+ *  DESCRIPTION
+ *      This function advances every channel of the ramp by one tick.
+ *
+ *  RETURNS
+ *      TRUE if the transition is still in progress after this tick.
+ *
+ *---------------------------------------------------------------------------*/
+extern bool LightRampStep(LIGHT_RAMP_T *ramp)
+{
+    LIGHT_RAMP_CHANNEL_T *channel;
+    uint16 delta;
+    uint8 idx;
+
+    if (ramp->steps_left == 0)
+    {
+        return FALSE;
+    }
+
+    for (idx = 0; idx < LIGHT_RAMP_CHANNELS; idx++)
+    {
+        channel = &ramp->channel[idx];
+
+        delta = channel->step;
+        channel->error += channel->remainder;
+        if (channel->error >= ramp->steps)
+        {
+            channel->error -= ramp->steps;
+            delta++;
+        }
+
+        if (channel->falling)
+        {
+            channel->current -= delta;
+        }
+        else
+        {
+            channel->current += delta;
+        }
+    }
+
+    return (--ramp->steps_left != 0);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      LightRampComplete
+ *
+ *  DESCRIPTION
+ *      This function ends the transition in progress, moving all the
+ *      channels to their target straight away.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void LightRampComplete(LIGHT_RAMP_T *ramp)
+{
+    uint8 idx;
+
+    for (idx = 0; idx < LIGHT_RAMP_CHANNELS; idx++)
+    {
+        ramp->channel[idx].current = ramp->channel[idx].target;
+    }
+    ramp->steps_left = 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      LightRampStop
+ *
+ *  DESCRIPTION
+ *      This function ends the transition in progress, leaving all the
+ *      channels on the levels currently reached.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void LightRampStop(LIGHT_RAMP_T *ramp)
+{
+    uint8 idx;
+
+    for (idx = 0; idx < LIGHT_RAMP_CHANNELS; idx++)
+    {
+        ramp->channel[idx].target = ramp->channel[idx].current;
+    }
+    ramp->steps_left = 0;
+}
@@ -0,0 +1,102 @@
+/******************************************************************************
+ *  Copyright Cambridge Silicon Radio Limited 2015
+ *  CSR Bluetooth Low Energy CSRmesh 1.3 Release
+ *  Application version 1.3
+ *
+ *  FILE
+ *      light_ramp.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the colour ramp used to fade the light between
+ *      two colours.
+ *
+ *****************************************************************************/
+
+#ifndef __LIGHT_RAMP_H__
+#define __LIGHT_RAMP_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Number of colour channels in a ramp */
+#define LIGHT_RAMP_CHANNELS         (3)
+
+/* Channel indexes in a ramp */
+#define LIGHT_RAMP_RED              (0)
+#define LIGHT_RAMP_GREEN            (1)
+#define LIGHT_RAMP_BLUE             (2)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Ramp state of a single colour channel. Levels are 16 bit duty cycles, from
+ * 0 (off) to 0xFFFF (fully on). The level moves by step on every
+ * tick, and by one more whenever the error accumulated from remainder
+ * reaches the number of steps of the ramp (Bresenham line), so all the
+ * channels of a ramp land on their target on the same tick.
+ */
+typedef struct
+{
+    /* Level currently reached by the channel */
+    uint16                         current;
+
+    /* Level the channel is ramping towards */
+    uint16                         target;
+
+    /* Whole levels added on every tick */
+    uint16                         step;
+
+    /* TRUE if the level is decreasing */
+    bool                           falling;
+
+    /* Fraction of a level added on every tick, in 1/steps units */
+    uint16                         remainder;
+
+    /* Accumulated fraction of a level, in 1/steps units */
+    uint16                         error;
+
+} LIGHT_RAMP_CHANNEL_T;
+
+/* Colour ramp */
+typedef struct
+{
+    /* Ramp state of each channel, indexed by LIGHT_RAMP_x */
+    LIGHT_RAMP_CHANNEL_T           channel[LIGHT_RAMP_CHANNELS];
+
+    /* Number of ticks of the current transition */
+    uint16                         steps;
+
+    /* Number of ticks left before the current transition completes */
+    uint16                         steps_left;
+
+} LIGHT_RAMP_T;
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Starts a transition from the current levels to a new target colour */
+extern void LightRampRetarget(LIGHT_RAMP_T *ramp, uint16 red, uint16 green,
+                              uint16 blue, uint16 steps);
+
+/* Advances the ramp by one tick */
+extern bool LightRampStep(LIGHT_RAMP_T *ramp);
+
+/* Moves all the channels of the ramp to their target straight away */
+extern void LightRampComplete(LIGHT_RAMP_T *ramp);
+
+/* Stops the ramp on the levels currently reached */
+extern void LightRampStop(LIGHT_RAMP_T *ramp);
+
+/* Checks whether a transition is in progress */
+#define LightRampInProgress(ramp)   ((ramp)->steps_left != 0)
+
+#endif /* __LIGHT_RAMP_H__ */
@@ -9,6 +9,25 @@
  *  DESCRIPTION
  *      This file defines routines used by application to access NVM.
  *
+ *      The start of the NVM store is cached in a RAM shadow. Writes update
+ *      the shadow and mark the words written as dirty, and the dirty words
+ *      are committed to the NVM once no write has been made for a short idle
+ *      window, with one NVM write per contiguous span of dirty words.
+ *
+ *      On EEPROM the shadow is stored in two slots, A and B, each with a
+ *      header holding a commit sequence number and a CRC of the slot. A
+ *      commit writes the inactive slot and its header last, so a reset in
+ *      the middle of a commit leaves the previous commit intact.
+ *
+ *      On SPI flash, which can only be erased as a whole, each commit is
+ *      appended to a log as a record protected by a CRC, and the log is
+ *      replayed into the shadow at boot. Once the log is nearly full it is
+ *      compacted when the NVM is idle, by erasing it and writing the whole
+ *      shadow back as a single record.
+ *
+ *      The words of the store written by the earlier versions of the
+ *      application are read when no commit is found.
+ *
  *****************************************************************************/
 
 /*============================================================================*
@@ -19,6 +38,9 @@
 #include <nvm.h>
 #include <i2c.h>
 #include <panic.h>
+#include <mem.h>
+#include <timer.h>
+#include <time.h>
 
 /*============================================================================*
  *  Local Header Files
@@ -26,6 +48,862 @@
 
 #include "nvm_access.h"
 #include "app_gatt.h"
+#include "soft_timer.h"
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Number of words of the map of dirty words of the shadow, one bit per word */
+#define NVM_DIRTY_MAP_WORDS            ((NVM_SHADOW_SIZE_WORDS + 15) / 16)
+
+/* Time without NVM write after which the dirty words are written to NVM */
+#define NVM_FLUSH_IDLE_TIME            (100 * MILLISECOND)
+
+#ifdef NVM_TYPE_FLASH
+/* Size of the log of commits in words. The log follows the words of the store
+ * written by the earlier versions of the application, and the words beyond
+ * the shadow follow the log, all in the NVM store configured on the SPI flash.
+ */
+#define NVM_LOG_SIZE_WORDS             (NVM_STORE_SIZE_WORDS - \
+                                        NVM_SHADOW_SIZE_WORDS - \
+                                        NVM_BEYOND_SHADOW_WORDS)
+
+/* NVM offset of the log */
+#define NVM_LOG_OFFSET                 (NVM_SHADOW_SIZE_WORDS)
+
+/* Words of the header of a log record: offset and length of the shadow words
+ * the record holds. An erased offset word marks the end of the log.
+ */
+#define NVM_RECORD_HEADER_WORDS        (2)
+
+/* Words of a log record besides the shadow words: header and CRC */
+#define NVM_RECORD_OVERHEAD_WORDS      (NVM_RECORD_HEADER_WORDS + 1)
+
+/* Free words in the log below which it is compacted, so that a commit of the
+ * whole shadow always fits without waiting for an erase.
+ */
+#define NVM_COMPACT_THRESHOLD_WORDS    (NVM_SHADOW_SIZE_WORDS + \
+                                        NVM_RECORD_OVERHEAD_WORDS)
+
+/* Time without NVM commit after which a nearly full log is compacted */
+#define NVM_COMPACT_IDLE_TIME          (5 * SECOND)
+
+/* Number of words read at a time to check the CRC of a log record */
+#define NVM_CRC_CHUNK_WORDS            (16)
+
+/* Offset added to the NVM offset of the words beyond the shadow, which are
+ * stored after the log. They are not kept when the log is compacted.
+ */
+#define NVM_BEYOND_STORE_OFFSET        (NVM_LOG_SIZE_WORDS)
+
+/* The log must hold the whole shadow twice over, so that compacting it leaves
+ * room for commits before the next compaction.
+ */
+#if NVM_STORE_SIZE_WORDS < (NVM_SHADOW_SIZE_WORDS + NVM_BEYOND_SHADOW_WORDS + \
+                            2 * NVM_COMPACT_THRESHOLD_WORDS)
+#error "NVM_STORE_SIZE_WORDS is too small for the log of commits"
+#endif
+#else
+/* Number of NVM slots holding the shadow */
+#define NVM_SLOTS                      (2)
+
+/* Words of the header of a slot: magic, commit sequence number and CRC */
+#define NVM_SLOT_HEADER_WORDS          (3)
+
+/* Index of the words in the header of a slot */
+#define NVM_SLOT_MAGIC_INDEX           (0)
+#define NVM_SLOT_SEQUENCE_INDEX        (1)
+#define NVM_SLOT_CRC_INDEX             (2)
+
+/* Magic word identifying a slot header */
+#define NVM_SLOT_MAGIC                 (0x5AB1)
+
+/* Size of a slot in words, header included */
+#define NVM_SLOT_SIZE_WORDS            (NVM_SLOT_HEADER_WORDS + \
+                                        NVM_SHADOW_SIZE_WORDS)
+
+/* NVM offset of a slot. The slots follow the words of the store written by
+ * the earlier versions of the application.
+ */
+#define NVM_SLOT_OFFSET(slot)          (NVM_SHADOW_SIZE_WORDS + \
+                                        ((slot) * NVM_SLOT_SIZE_WORDS))
+
+/* Offset added to the NVM offset of the words beyond the shadow, which are
+ * stored after the slots.
+ */
+#define NVM_BEYOND_STORE_OFFSET        (NVM_SLOTS * NVM_SLOT_SIZE_WORDS)
+
+/* The words of the earlier versions, the slots and the words beyond the
+ * shadow must fit in the NVM store configured in the keyr file.
+ */
+#if (NVM_BEYOND_STORE_OFFSET + NVM_SHADOW_SIZE_WORDS + \
+     NVM_BEYOND_SHADOW_WORDS) > NVM_STORE_SIZE_WORDS
+#error "The NVM layout does not fit NVM_STORE_SIZE_WORDS"
+#endif
+#endif /* NVM_TYPE_FLASH */
+
+#ifdef ENABLE_NVM_STATS
+/* Count a failure recovered from without a panic */
+#define NVM_STATS_RECOVERED(site)      (nvm_stats[(site)].recovered++)
+#else
+/* NVM accesses without statistics */
+#define readNvm(site, buffer, length, offset) \
+                                       NvmRead((buffer), (length), (offset))
+#define writeNvm(site, buffer, length, offset) \
+                                       NvmWrite((buffer), (length), (offset))
+#define eraseNvm(site)                 NvmErase(TRUE)
+#define NVM_STATS_RECOVERED(site)
+#endif /* ENABLE_NVM_STATS */
+
+/* CRC-16-CCITT polynomial and initial value of the commit CRC */
+#define NVM_CRC_POLYNOMIAL             (0x1021)
+#define NVM_CRC_INIT                   (0xFFFF)
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* RAM shadow of the start of the NVM store */
+static uint16 nvm_shadow[NVM_SHADOW_SIZE_WORDS];
+
+/* Words of the shadow not yet written to NVM, one bit per word */
+static uint16 nvm_dirty_map[NVM_DIRTY_MAP_WORDS];
+
+#ifdef NVM_TYPE_FLASH
+/* Offset in the log of the next record */
+static uint16 nvm_log_head = 0;
+
+/* Timer compacting the log once the NVM is idle */
+static timer_id nvm_compact_tid = TIMER_INVALID;
+#else
+/* Words of the shadow the inactive slot does not hold, as they were written
+ * by the last commit or the slot content is unknown.
+ */
+static uint16 nvm_stale_map[NVM_DIRTY_MAP_WORDS];
+
+/* Slot holding the last commit */
+static uint16 nvm_active_slot = 0;
+
+/* Sequence number of the last commit */
+static uint16 nvm_commit_seq = 0;
+#endif /* NVM_TYPE_FLASH */
+
+/* TRUE once the shadow has been read from NVM */
+static bool nvm_shadow_loaded = FALSE;
+
+/* Timer writing the dirty words to NVM at the end of the idle window */
+static SOFT_TIMER_T nvm_flush_timer;
+
+#ifdef ENABLE_NVM_STATS
+/* Statistics of the NVM accesses of each site */
+static NVM_SITE_STATS_T nvm_stats[nvm_site_count];
+#endif /* ENABLE_NVM_STATS */
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+#ifdef ENABLE_NVM_STATS
+/* Records an NVM access in the statistics of its site */
+static void recordAccess(nvm_stats_site site, uint16 length, uint32 start);
+
+/* Reads words from NVM and records the access */
+static sys_status readNvm(nvm_stats_site site, uint16 *buffer, uint16 length,
+                          uint16 offset);
+
+/* Writes words to NVM and records the access */
+static sys_status writeNvm(nvm_stats_site site, uint16 *buffer, uint16 length,
+                           uint16 offset);
+
+/* Erases the NVM and records the access */
+static sys_status eraseNvm(nvm_stats_site site);
+#endif /* ENABLE_NVM_STATS */
+
+/* Calculates the CRC of a buffer of words */
+static uint16 crcWords(uint16 crc, const uint16 *words, uint16 length);
+
+/* Returns TRUE if a word of the shadow is dirty */
+static bool isDirty(uint16 offset);
+
+#ifdef NVM_TYPE_FLASH
+/* Appends a record of shadow words to the log */
+static sys_status appendRecord(uint16 offset, uint16 length);
+
+/* Erases the NVM and writes the whole shadow back */
+static void compactLog(void);
+
+/* Handles the expiry of the compaction timer */
+static void compactTimerHandler(timer_id tid);
+#else
+/* Reads a slot into the shadow and checks it */
+static bool readSlot(uint16 slot, const uint16 *header, sys_status *result);
+
+/* Returns TRUE if a word of the inactive slot needs to be written */
+static bool isStale(uint16 offset);
+#endif /* NVM_TYPE_FLASH */
+
+/* Reads the last commit into the shadow */
+static bool readStore(sys_status *result);
+
+/* Writes the dirty words of the shadow to NVM as a commit */
+static sys_status writeDirtySpans(void);
+
+/* Handles the expiry of the flush timer */
+static void flushTimerHandler(void);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+#ifdef ENABLE_NVM_STATS
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      recordAccess
+ *
+ *  DESCRIPTION
+ *      This function adds an NVM access started at the given time to the
+ *      statistics of its site.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void recordAccess(nvm_stats_site site, uint16 length, uint32 start)
+{
+    NVM_SITE_STATS_T *p_stats = &nvm_stats[site];
+    uint32 duration = TimeGet32() - start;
+
+    p_stats->count++;
+    p_stats->words += length;
+    p_stats->total_time += duration;
+    if(duration > p_stats->max_time)
+    {
+        p_stats->max_time = duration;
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      readNvm
+ *
+ *  DESCRIPTION
+ *      This function reads words from NVM and records the access in the
+ *      statistics of the site.
+ *
+ *  RETURNS
+ *      Status of the NVM read.
+ *
+ *---------------------------------------------------------------------------*/
+static sys_status readNvm(nvm_stats_site site, uint16 *buffer, uint16 length,
+                          uint16 offset)
+{
+    uint32 start = TimeGet32();
+    sys_status result = NvmRead(buffer, length, offset);
+
+    recordAccess(site, length, start);
+    return result;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      writeNvm
+ *
+ *  DESCRIPTION
+ *      This function writes words to NVM and records the access in the
+ *      statistics of the site.
+ *
+ *  RETURNS
+ *      Status of the NVM write.
+ *
+ *---------------------------------------------------------------------------*/
+static sys_status writeNvm(nvm_stats_site site, uint16 *buffer, uint16 length,
+                           uint16 offset)
+{
+    uint32 start = TimeGet32();
+    sys_status result = NvmWrite(buffer, length, offset);
+
+    recordAccess(site, length, start);
+    return result;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      eraseNvm
+ *
+ *  DESCRIPTION
+ *      This function erases the NVM and records the access in the
+ *      statistics of the site.
+ *
+ *  RETURNS
+ *      Status of the NVM erase.
+ *
+ *---------------------------------------------------------------------------*/
+static sys_status eraseNvm(nvm_stats_site site)
+{
+    uint32 start = TimeGet32();
+    sys_status result = NvmErase(TRUE);
+
+    recordAccess(site, 0, start);
+    return result;
+}
+#endif /* ENABLE_NVM_STATS */
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      crcWords
+ *
+ *  DESCRIPTION
+ *      This function updates a CRC-16-CCITT with a buffer of words, most
+ *      significant bit first.
+ *
+ *  RETURNS
+ *      Updated CRC.
+ *
+ *---------------------------------------------------------------------------*/
+static uint16 crcWords(uint16 crc, const uint16 *words, uint16 length)
+{
+    uint16 bit;
+
+    for(; length > 0; length--, words++)
+    {
+        crc ^= *words;
+        for(bit = 0; bit < 16; bit++)
+        {
+            if(crc & 0x8000)
+            {
+                crc = (uint16)(crc << 1) ^ NVM_CRC_POLYNOMIAL;
+            }
+            else
+            {
+                crc = (uint16)(crc << 1);
+            }
+        }
+    }
+
+    return crc;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      isDirty
+ *
+ *  DESCRIPTION
+ *      This function checks whether a word of the shadow has been written
+ *      since it was last committed to NVM.
+ *
+ *  RETURNS
+ *      TRUE if the word is dirty.
+ *
+ *---------------------------------------------------------------------------*/
+static bool isDirty(uint16 offset)
+{
+    return ((nvm_dirty_map[offset >> 4] >> (offset & 0xF)) & 0x1) != 0;
+}
+
+#ifdef NVM_TYPE_FLASH
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appendRecord
+ *
+ *  DESCRIPTION
+ *      This function appends a record of shadow words to the log. The CRC is
+ *      written last, so a record torn by a reset is not replayed. The NVM is
+ *      left enabled.
+ *
+ *  RETURNS
+ *      Status of the first NVM write that failed, or sys_status_success.
+ *
+ *---------------------------------------------------------------------------*/
+static sys_status appendRecord(uint16 offset, uint16 length)
+{
+    sys_status result;
+    uint16 header[NVM_RECORD_HEADER_WORDS];
+    uint16 crc;
+    uint16 record = NVM_LOG_OFFSET + nvm_log_head;
+
+    header[0] = offset;
+    header[1] = length;
+    crc = crcWords(crcWords(NVM_CRC_INIT, header, NVM_RECORD_HEADER_WORDS),
+                   &nvm_shadow[offset], length);
+
+    /* Write to NVM. Firmware re-enables the NVM if it is disabled */
+    result = writeNvm(nvm_site_commit, header, NVM_RECORD_HEADER_WORDS,
+                      record);
+    if(sys_status_success == result)
+    {
+        result = writeNvm(nvm_site_commit, &nvm_shadow[offset], length,
+                          record + NVM_RECORD_HEADER_WORDS);
+    }
+    if(sys_status_success == result)
+    {
+        result = writeNvm(nvm_site_commit, &crc, 1,
+                          record + NVM_RECORD_HEADER_WORDS + length);
+    }
+
+    if(sys_status_success == result)
+    {
+        nvm_log_head += length + NVM_RECORD_OVERHEAD_WORDS;
+    }
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      compactLog
+ *
+ *  DESCRIPTION
+ *      This function compacts the log by erasing the NVM and writing the
+ *      whole shadow back as a single record. The SPI flash can only be
+ *      erased as a whole, so this is done when the log is nearly full and
+ *      the NVM is idle, or when a write needs an erase.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void compactLog(void)
+{
+    sys_status result;
+
+    TimerDelete(nvm_compact_tid);
+    nvm_compact_tid = TIMER_INVALID;
+    SoftTimerStop(&nvm_flush_timer);
+
+    /* The shadow holds all the data of the log, so we can erase the NVM */
+    Nvm_Erase();
+    nvm_log_head = 0;
+
+    result = appendRecord(0, NVM_SHADOW_SIZE_WORDS);
+
+    /* Disable NVM to save power after write operation */
+    Nvm_Disable();
+
+    if(sys_status_success != result)
+    {
+        /* Irrecoverable error. Reset the chip. */
+        ReportPanic(app_panic_nvm_write);
+    }
+
+    MemSet(nvm_dirty_map, 0, sizeof(nvm_dirty_map));
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      compactTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function compacts the log once no NVM commit has been made for
+ *      the compaction idle time.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void compactTimerHandler(timer_id tid)
+{
+    if(tid == nvm_compact_tid)
+    {
+        nvm_compact_tid = TIMER_INVALID;
+
+        if(SoftTimerRunning(&nvm_flush_timer))
+        {
+            /* Words are still being written, wait for the NVM to be idle */
+            nvm_compact_tid = TimerCreate(NVM_COMPACT_IDLE_TIME, TRUE,
+                                          compactTimerHandler);
+        }
+        else
+        {
+            compactLog();
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      readStore
+ *
+ *  DESCRIPTION
+ *      This function replays the log into the shadow. A record is only
+ *      applied once its CRC has been checked. The replay stops at the end
+ *      of the log or at a record torn by a reset, which cannot be written
+ *      over, in which case the log is compacted on the next commit.
+ *
+ *  RETURNS
+ *      TRUE if a record was replayed.
+ *
+ *---------------------------------------------------------------------------*/
+static bool readStore(sys_status *result)
+{
+    uint16 header[NVM_RECORD_HEADER_WORDS];
+    uint16 chunk[NVM_CRC_CHUNK_WORDS];
+    uint16 record;
+    uint16 offset;
+    uint16 length;
+    uint16 done;
+    uint16 count;
+    uint16 crc;
+    uint16 record_crc;
+    bool found = FALSE;
+
+    nvm_log_head = 0;
+
+    while(sys_status_success == *result &&
+          NVM_LOG_SIZE_WORDS - nvm_log_head >= NVM_RECORD_OVERHEAD_WORDS)
+    {
+        record = NVM_LOG_OFFSET + nvm_log_head;
+
+        *result = readNvm(nvm_site_load, header, NVM_RECORD_HEADER_WORDS,
+                          record);
+        if(sys_status_success != *result)
+        {
+            break;
+        }
+
+        offset = header[0];
+        length = header[1];
+
+        if(offset == NVM_DEFAULT_ERASED_WORD)
+        {
+            /* End of the log */
+            return found;
+        }
+
+        if(offset >= NVM_SHADOW_SIZE_WORDS || length == 0 ||
+           length > NVM_SHADOW_SIZE_WORDS - offset ||
+           length > NVM_LOG_SIZE_WORDS - nvm_log_head -
+                    NVM_RECORD_OVERHEAD_WORDS)
+        {
+            /* Torn record, the commits before it are used */
+            NVM_STATS_RECOVERED(nvm_site_load);
+            break;
+        }
+
+        /* Check the CRC before the record is applied to the shadow */
+        crc = crcWords(NVM_CRC_INIT, header, NVM_RECORD_HEADER_WORDS);
+        for(done = 0; done < length && sys_status_success == *result;
+            done += count)
+        {
+            count = length - done;
+            if(count > NVM_CRC_CHUNK_WORDS)
+            {
+                count = NVM_CRC_CHUNK_WORDS;
+            }
+
+            *result = readNvm(nvm_site_load, chunk, count,
+                              record + NVM_RECORD_HEADER_WORDS + done);
+            crc = crcWords(crc, chunk, count);
+        }
+
+        if(sys_status_success == *result)
+        {
+            *result = readNvm(nvm_site_load, &record_crc, 1,
+                              record + NVM_RECORD_HEADER_WORDS + length);
+        }
+
+        if(sys_status_success != *result)
+        {
+            break;
+        }
+
+        if(crc != record_crc)
+        {
+            /* Torn record, the commits before it are used */
+            NVM_STATS_RECOVERED(nvm_site_load);
+            break;
+        }
+
+        *result = readNvm(nvm_site_load, &nvm_shadow[offset], length,
+                          record + NVM_RECORD_HEADER_WORDS);
+        nvm_log_head += length + NVM_RECORD_OVERHEAD_WORDS;
+        found = TRUE;
+    }
+
+    /* The log is full or ends with a torn record */
+    nvm_log_head = NVM_LOG_SIZE_WORDS;
+
+    return found;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      writeDirtySpans
+ *
+ *  DESCRIPTION
+ *      This function commits the dirty words of the shadow by appending a
+ *      single record spanning all of them to the log, and disables the NVM
+ *      afterwards. If the record does not fit, the log is compacted instead.
+ *
+ *  RETURNS
+ *      Status of the first NVM write that failed, or sys_status_success.
+ *
+ *---------------------------------------------------------------------------*/
+static sys_status writeDirtySpans(void)
+{
+    sys_status result;
+    uint16 start;
+    uint16 end;
+
+    for(start = 0; start < NVM_SHADOW_SIZE_WORDS && !isDirty(start); start++)
+    {
+    }
+
+    /* Nothing to commit if no word is dirty */
+    if(start == NVM_SHADOW_SIZE_WORDS)
+    {
+        return sys_status_success;
+    }
+
+    for(end = NVM_SHADOW_SIZE_WORDS; !isDirty(end - 1); end--)
+    {
+    }
+
+    if(end - start > NVM_LOG_SIZE_WORDS - nvm_log_head -
+                     NVM_RECORD_OVERHEAD_WORDS ||
+       nvm_log_head + NVM_RECORD_OVERHEAD_WORDS > NVM_LOG_SIZE_WORDS)
+    {
+        compactLog();
+        return sys_status_success;
+    }
+
+    result = appendRecord(start, end - start);
+
+    /* Disable NVM to save power after write operation */
+    Nvm_Disable();
+
+    if(sys_status_success == result)
+    {
+        MemSet(nvm_dirty_map, 0, sizeof(nvm_dirty_map));
+
+        /* Compact a nearly full log before a commit has to wait for it */
+        if(NVM_LOG_SIZE_WORDS - nvm_log_head < NVM_COMPACT_THRESHOLD_WORDS &&
+           nvm_compact_tid == TIMER_INVALID)
+        {
+            nvm_compact_tid = TimerCreate(NVM_COMPACT_IDLE_TIME, TRUE,
+                                          compactTimerHandler);
+        }
+    }
+
+    return result;
+}
+#else /* EEPROM */
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      readSlot
+ *
+ *  DESCRIPTION
+ *      This function reads a slot into the shadow and checks it against the
+ *      CRC in its header.
+ *
+ *  RETURNS
+ *      TRUE if the slot is valid.
+ *
+ *---------------------------------------------------------------------------*/
+static bool readSlot(uint16 slot, const uint16 *header, sys_status *result)
+{
+    uint16 crc;
+
+    if(header[NVM_SLOT_MAGIC_INDEX] != NVM_SLOT_MAGIC ||
+       sys_status_success != *result)
+    {
+        return FALSE;
+    }
+
+    *result = readNvm(nvm_site_load, nvm_shadow, NVM_SHADOW_SIZE_WORDS,
+                      NVM_SLOT_OFFSET(slot) + NVM_SLOT_HEADER_WORDS);
+    if(sys_status_success != *result)
+    {
+        return FALSE;
+    }
+
+    crc = crcWords(NVM_CRC_INIT, &header[NVM_SLOT_SEQUENCE_INDEX], 1);
+    crc = crcWords(crc, nvm_shadow, NVM_SHADOW_SIZE_WORDS);
+
+    return crc == header[NVM_SLOT_CRC_INDEX];
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      isStale
+ *
+ *  DESCRIPTION
+ *      This function checks whether a word of the inactive slot differs
+ *      from the shadow, as the word is dirty or was written by the last
+ *      commit to the other slot.
+ *
+ *  RETURNS
+ *      TRUE if the word needs to be written.
+ *
+ *---------------------------------------------------------------------------*/
+static bool isStale(uint16 offset)
+{
+    return (((nvm_dirty_map[offset >> 4] | nvm_stale_map[offset >> 4]) >>
+             (offset & 0xF)) & 0x1) != 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      readStore
+ *
+ *  DESCRIPTION
+ *      This function reads the slot with the newest commit into the shadow,
+ *      or the other slot if the CRC of the newest one does not match.
+ *
+ *  RETURNS
+ *      TRUE if a valid slot was read.
+ *
+ *---------------------------------------------------------------------------*/
+static bool readStore(sys_status *result)
+{
+    uint16 header[NVM_SLOTS][NVM_SLOT_HEADER_WORDS];
+    uint16 newest;
+    uint16 slot;
+    uint16 index;
+
+    /* The content of the inactive slot is not known */
+    MemSet(nvm_stale_map, 0xFFFF, sizeof(nvm_stale_map));
+
+    /* Read from NVM. Firmware re-enables the NVM if it is disabled */
+    *result = readNvm(nvm_site_load, header[0], NVM_SLOT_HEADER_WORDS,
+                      NVM_SLOT_OFFSET(0));
+    if(sys_status_success == *result)
+    {
+        *result = readNvm(nvm_site_load, header[1], NVM_SLOT_HEADER_WORDS,
+                          NVM_SLOT_OFFSET(1));
+    }
+
+    /* Try the slot with the newest commit first */
+    newest = ((int16)(header[1][NVM_SLOT_SEQUENCE_INDEX] -
+                      header[0][NVM_SLOT_SEQUENCE_INDEX]) > 0) ? 1 : 0;
+
+    for(index = 0; index < NVM_SLOTS; index++)
+    {
+        slot = (newest + index) % NVM_SLOTS;
+        if(readSlot(slot, header[slot], result))
+        {
+            if(index != 0)
+            {
+                /* The newest commit was torn, the previous one is used */
+                NVM_STATS_RECOVERED(nvm_site_load);
+            }
+
+            nvm_active_slot = slot;
+            nvm_commit_seq = header[slot][NVM_SLOT_SEQUENCE_INDEX];
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      writeDirtySpans
+ *
+ *  DESCRIPTION
+ *      This function commits the dirty words of the shadow to the inactive
+ *      slot. The words the slot does not hold yet are written first, merging
+ *      adjacent words into a single NVM write, and the slot header last, so
+ *      the slot only becomes valid once all of them are written. The NVM is
+ *      disabled afterwards.
+ *
+ *  RETURNS
+ *      Status of the first NVM write that failed, or sys_status_success.
+ *
+ *---------------------------------------------------------------------------*/
+static sys_status writeDirtySpans(void)
+{
+    sys_status result = sys_status_success;
+    uint16 header[NVM_SLOT_HEADER_WORDS];
+    uint16 slot = (nvm_active_slot + 1) % NVM_SLOTS;
+    uint16 base = NVM_SLOT_OFFSET(slot) + NVM_SLOT_HEADER_WORDS;
+    uint16 start;
+    uint16 end;
+
+    /* Nothing to commit if no word is dirty */
+    for(start = 0; start < NVM_DIRTY_MAP_WORDS; start++)
+    {
+        if(nvm_dirty_map[start] != 0)
+        {
+            break;
+        }
+    }
+    if(start == NVM_DIRTY_MAP_WORDS)
+    {
+        return sys_status_success;
+    }
+
+    start = 0;
+    while(start < NVM_SHADOW_SIZE_WORDS)
+    {
+        if(!isStale(start))
+        {
+            start++;
+            continue;
+        }
+
+        /* Find the end of this span of words */
+        for(end = start + 1; end < NVM_SHADOW_SIZE_WORDS && isStale(end); end++)
+        {
+        }
+
+        /* Write to NVM. Firmware re-enables the NVM if it is disabled */
+        result = writeNvm(nvm_site_commit, &nvm_shadow[start], end - start,
+                          base + start);
+        if(sys_status_success != result)
+        {
+            break;
+        }
+
+        start = end;
+    }
+
+    if(sys_status_success == result)
+    {
+        header[NVM_SLOT_MAGIC_INDEX] = NVM_SLOT_MAGIC;
+        header[NVM_SLOT_SEQUENCE_INDEX] = nvm_commit_seq + 1;
+        header[NVM_SLOT_CRC_INDEX] =
+            crcWords(crcWords(NVM_CRC_INIT, &header[NVM_SLOT_SEQUENCE_INDEX], 1),
+                     nvm_shadow, NVM_SHADOW_SIZE_WORDS);
+
+        /* The commit is complete once the header is written */
+        result = writeNvm(nvm_site_commit, header, NVM_SLOT_HEADER_WORDS,
+                          NVM_SLOT_OFFSET(slot));
+    }
+
+    /* Disable NVM to save power after write operation */
+    Nvm_Disable();
+
+    if(sys_status_success == result)
+    {
+        /* The other slot now lacks the words of this commit */
+        MemCopy(nvm_stale_map, nvm_dirty_map, sizeof(nvm_stale_map));
+        MemSet(nvm_dirty_map, 0, sizeof(nvm_dirty_map));
+        nvm_active_slot = slot;
+        nvm_commit_seq++;
+    }
+
+    return result;
+}
+#endif /* NVM_TYPE_FLASH */
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      flushTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function writes the dirty words to NVM once no NVM write has been
+ *      made for the idle window.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void flushTimerHandler(void)
+{
+    Nvm_Flush();
+}
 
 /*============================================================================*
  *  Public Function Implementations
@@ -51,6 +929,56 @@ extern void Nvm_Disable(void)
 }
 
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_Load
+ *
+ *  DESCRIPTION
+ *      This function reads the last commit into the shadow the first time it
+ *      is called. Nvm_Read and Nvm_Write call it, and the application may
+ *      call it to choose when the read is made.
+ *
+ *      If no commit is found the shadow is read from the words written by
+ *      the earlier versions of the application, and all of it is committed
+ *      to a slot on the next flush.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+
+extern void Nvm_Load(void)
+{
+    sys_status result = sys_status_success;
+    bool found;
+
+    if(nvm_shadow_loaded)
+    {
+        return;
+    }
+
+    found = readStore(&result);
+
+    if(!found && sys_status_success == result)
+    {
+        result = readNvm(nvm_site_load, nvm_shadow, NVM_SHADOW_SIZE_WORDS,
+                         0);
+    }
+
+    /* Disable NVM to save power after read operation */
+    Nvm_Disable();
+
+    /* Report panic if NVM read is not successful */
+    if(sys_status_success != result)
+    {
+        ReportPanic(app_panic_nvm_read);
+    }
+
+    MemSet(nvm_dirty_map, found ? 0 : 0xFFFF, sizeof(nvm_dirty_map));
+    nvm_shadow_loaded = TRUE;
+}
+
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      Nvm_Read
@@ -61,7 +989,7 @@ extern void Nvm_Disable(void)
  *      application to save power on NVM.
  *
  *      Read words starting at the word offset, and store them in the supplied
- *      buffer.
+ *      buffer. The words cached in the shadow are read from the shadow.
  *
  *  RETURNS
  *      Nothing
@@ -71,9 +999,32 @@ extern void Nvm_Disable(void)
 extern void Nvm_Read(uint16* buffer, uint16 length, uint16 offset)
 {
     sys_status result;
+    uint16 count;
+
+    Nvm_Load();
+
+    if(offset < NVM_SHADOW_SIZE_WORDS)
+    {
+        count = NVM_SHADOW_SIZE_WORDS - offset;
+        if(count > length)
+        {
+            count = length;
+        }
+
+        MemCopy(buffer, &nvm_shadow[offset], count);
+        buffer += count;
+        length -= count;
+        offset += count;
+    }
+
+    if(length == 0)
+    {
+        return;
+    }
 
     /* Read from NVM. Firmware re-enables the NVM if it is disabled */
-    result = NvmRead(buffer, length, offset);
+    result = readNvm(nvm_site_read, buffer, length,
+                     offset + NVM_BEYOND_STORE_OFFSET);
 
     /* Disable NVM to save power after read operation */
     Nvm_Disable();
@@ -97,7 +1048,8 @@ extern void Nvm_Read(uint16* buffer, uint16 length, uint16 offset)
  *      application to save power on NVM.
  *
  *      Write words from the supplied buffer into the NVM Store, starting at the
- *      given word offset.
+ *      given word offset. The words cached in the shadow are written to the
+ *      shadow, and to the NVM at the end of the idle window or on Nvm_Flush.
  *
  *  RETURNS
  *      Nothing
@@ -107,9 +1059,42 @@ extern void Nvm_Read(uint16* buffer, uint16 length, uint16 offset)
 extern void Nvm_Write(uint16* buffer, uint16 length, uint16 offset)
 {
     sys_status result;
+    uint16 count;
+
+    Nvm_Load();
+
+    if(offset < NVM_SHADOW_SIZE_WORDS)
+    {
+        count = NVM_SHADOW_SIZE_WORDS - offset;
+        if(count > length)
+        {
+            count = length;
+        }
+
+        MemCopy(&nvm_shadow[offset], buffer, count);
+        buffer += count;
+        length -= count;
+
+        for(; count > 0; count--, offset++)
+        {
+            nvm_dirty_map[offset >> 4] |= ((uint16)0x1 << (offset & 0xF));
+        }
+
+        /* Restart the idle window. This only re-arms the shared SDK timer
+         * when the window ends before every other software timer.
+         */
+        SoftTimerStart(&nvm_flush_timer, NVM_FLUSH_IDLE_TIME,
+                       flushTimerHandler);
+    }
+
+    if(length == 0)
+    {
+        return;
+    }
 
     /* Write to NVM. Firmware re-enables the NVM if it is disabled */
-    result = NvmWrite(buffer, length, offset);
+    result = writeNvm(nvm_site_write, buffer, length,
+                      offset + NVM_BEYOND_STORE_OFFSET);
 
     /* Disable NVM to save power after write operation */
     Nvm_Disable();
@@ -123,16 +1108,61 @@ extern void Nvm_Write(uint16* buffer, uint16 length, uint16 offset)
 #ifdef NVM_TYPE_FLASH
     else if(nvm_status_needs_erase == result)
     {
-        /* The application already has a copy of NVM data in its variables,
-         * so we can erase the NVM 
-         */
-        Nvm_Erase();
+        /* Compacting the log erases the NVM, then the words can be written */
+        NVM_STATS_RECOVERED(nvm_site_write);
+        compactLog();
+        result = writeNvm(nvm_site_write, buffer, length,
+                          offset + NVM_BEYOND_STORE_OFFSET);
+        Nvm_Disable();
 
-        /* Write back the NVM data. 
-         * Please note that the following function writes data into NVM and 
-         * should not fail. 
-         */
-         WriteApplicationAndServiceDataToNVM();
+        if(sys_status_success != result)
+        {
+            /* Irrecoverable error. Reset the chip. */
+            ReportPanic(app_panic_nvm_write);
+        }
+    }
+#endif /* NVM_TYPE_FLASH */
+    else
+    {
+        /* Irrecoverable error. Reset the chip. */
+        ReportPanic(app_panic_nvm_write);
+    }
+}
+
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_Flush
+ *
+ *  DESCRIPTION
+ *      Write the words of the shadow written since the last flush to the NVM
+ *      store straight away, without waiting for the idle window. This is
+ *      called where the data must survive a reset that may follow shortly.
+ *
+ *  RETURNS
+ *      Nothing
+ *
+ *---------------------------------------------------------------------------*/
+
+extern void Nvm_Flush(void)
+{
+    sys_status result;
+
+    SoftTimerStop(&nvm_flush_timer);
+
+    result = writeDirtySpans();
+
+    /* If the writes were a success, return */
+    if(sys_status_success == result)
+    {
+        return;
+    }
+#ifdef NVM_TYPE_FLASH
+    else if(nvm_status_needs_erase == result)
+    {
+        /* A torn record is in the way, compact the log */
+        NVM_STATS_RECOVERED(nvm_site_commit);
+        compactLog();
     }
 #endif /* NVM_TYPE_FLASH */
     else
@@ -161,7 +1191,7 @@ extern void Nvm_Erase(void)
     sys_status result;
 
     /* NvmErase automatically enables the NVM before erasing */
-    result = NvmErase(TRUE);
+    result = eraseNvm(nvm_site_erase);
 
     /* Disable NVM after erasing */
     Nvm_Disable();
@@ -174,3 +1204,20 @@ extern void Nvm_Erase(void)
 }
 #endif /* NVM_TYPE_FLASH */
 
+#ifdef ENABLE_NVM_STATS
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_GetStats
+ *
+ *  DESCRIPTION
+ *      Reads the statistics of the NVM accesses made at a site.
+ *
+ *  RETURNS
+ *      Nothing
+ *
+ *---------------------------------------------------------------------------*/
+extern void Nvm_GetStats(nvm_stats_site site, NVM_SITE_STATS_T *p_stats)
+{
+    MemCopy(p_stats, &nvm_stats[site], sizeof(NVM_SITE_STATS_T));
+}
+#endif /* ENABLE_NVM_STATS */
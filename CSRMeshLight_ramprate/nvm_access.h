@@ -21,6 +21,69 @@
 #include <types.h>
 #include <status.h>
 
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "user_config.h"
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Number of words at the start of the NVM store cached in the RAM shadow. It
+ * covers the application data and the GAP service data, and on SPI flash the
+ * sequence number ring. Words beyond it are read from and written to the NVM
+ * directly.
+ */
+#define NVM_SHADOW_SIZE_WORDS          (128)
+
+/* Number of words beyond the shadow that the application may use */
+#define NVM_BEYOND_SHADOW_WORDS        (32)
+
+#ifdef NVM_TYPE_FLASH
+/* Size of the NVM store on SPI flash in words. It must match &nvm_size in the
+ * keyr file, and the log of nvm_access.c is sized from it.
+ */
+#define NVM_STORE_SIZE_WORDS           (0x400)
+#else
+/* Size of the NVM store on EEPROM in words. It must match &NVM_SIZE in the
+ * keyr file, and the layout of nvm_access.c is checked against it at build
+ * time.
+ */
+#define NVM_STORE_SIZE_WORDS           (0x200)
+#endif /* NVM_TYPE_FLASH */
+
+#ifdef ENABLE_NVM_STATS
+/* Sites of the NVM accesses made by the NVM store */
+typedef enum
+{
+    nvm_site_load = 0,          /* Read of the store into the shadow */
+    nvm_site_commit,            /* Commit of the shadow */
+    nvm_site_read,              /* Read of words beyond the shadow */
+    nvm_site_write,             /* Write of words beyond the shadow */
+    nvm_site_erase,             /* Erase of the NVM */
+    nvm_site_count
+} nvm_stats_site;
+
+/* Statistics of the NVM accesses made at a site */
+typedef struct
+{
+    /* Number of NVM accesses */
+    uint16                         count;
+
+    /* Number of words read or written */
+    uint32                         words;
+
+    /* Total and longest duration of the accesses in microseconds */
+    uint32                         total_time;
+    uint32                         max_time;
+
+    /* Failures recovered from without a panic */
+    uint16                         recovered;
+} NVM_SITE_STATS_T;
+#endif /* ENABLE_NVM_STATS */
+
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -30,15 +93,26 @@
  */
 extern void Nvm_Disable(void);
 
+/* Read the start of the NVM store into RAM in one pass */
+extern void Nvm_Load(void);
+
 /* Read words from the NVM store after preparing the NVM to be readable */
 extern void Nvm_Read(uint16* buffer, uint16 length, uint16 offset);
 
 /* Write words to the NVM store after preparing the NVM to be writable */
 extern void Nvm_Write(uint16* buffer, uint16 length, uint16 offset);
 
+/* Commit the pending words to the NVM store straight away */
+extern void Nvm_Flush(void);
+
 #ifdef NVM_TYPE_FLASH
 /* Erases the NVM memory.*/
 extern void Nvm_Erase(void);
 #endif /* NVM_TYPE_FLASH */
 
+#ifdef ENABLE_NVM_STATS
+/* Reads the statistics of the NVM accesses made at a site */
+extern void Nvm_GetStats(nvm_stats_site site, NVM_SITE_STATS_T *p_stats);
+#endif /* ENABLE_NVM_STATS */
+
 #endif /* __NVM_ACCESS_H__ */
\ No newline at end of file
@@ -16,6 +16,20 @@
 ; Local variables
 .equ TEMP, 0x3e
 
+; Address of R1 in register bank 0, to save it on the stack
+.equ R1_ADDR, 0x01
+
+; High resolution mode. Each BRIGHT duty cycle has a 4 bit fraction of a step
+; (in the upper nibble of a byte), added to an accumulator at the end of every
+; BRIGHT pulse. The pulses for which the accumulator overflows are one step
+; longer, giving a 12 bit average duty cycle over 16 pulses.
+; 0x10~0x17 Fractions of the BRIGHT duty cycles
+; 0x18~0x1f Fraction accumulators
+; 0x20~0x27 BRIGHT duty cycles the fractions are added to
+.equ FRACTION, 0x10
+.equ ACCUMULATOR, FRACTION+8
+.equ BASE_WIDTH, FRACTION+16
+
 ; Shared memory from 0x40
 ; 0~7 BRIGHT duty cycles
 ; 8~15 DULL duty cycles
@@ -23,12 +37,25 @@
 ; 18 BRIGHT period
 ; 20 DULL period
 ; 22 RESET
+; 24 COMMIT, set when the staged duty cycles and states are to be applied
+; 26~33 Staged BRIGHT duty cycles
+; 34~41 Staged DULL duty cycles
+; 42 Staged initial states of outputs
+; 44~51 Staged fractions of the BRIGHT duty cycles
+; 52 HIRES, set to enable the high resolution mode
 
 .equ SHARED_MEM, 0x40
 .equ INIT_STATE, SHARED_MEM+16
 .equ BRIGHT_PERIOD, SHARED_MEM+18
 .equ DULL_PERIOD, SHARED_MEM+20
 .equ PWM_RESET, SHARED_MEM+22
+.equ PWM_COMMIT, SHARED_MEM+24
+.equ STAGED_MEM, SHARED_MEM+26
+.equ STAGED_FRACTION, SHARED_MEM+44
+.equ PWM_HIRES, SHARED_MEM+52
+
+; Number of bytes copied from the staged to the active duty cycles and states
+.equ STAGED_SIZE, 17
 
 ; HW registers
 .equ P0_DRIVE_EN, 0xc0
@@ -37,7 +64,34 @@
 .equ P3_DRIVE_EN, 0xe8
 
 ; IDLE LOOP COUNT to make each step 4 microseconds
-.equ IDLE_COUNT, 6
+.equ IDLE_COUNT, 1
+
+; Lengths of the DELAY loop standing in for COMMIT and DITHER when there is
+; nothing to apply, so that every pulse lasts the same number of cycles
+.equ COMMIT_PAD, 113
+.equ DITHER_PAD, 143
+.equ DITHER_PAD_DULL, DITHER_PAD+2
+
+; Cycle counts, in 8051 machine cycles. Every path through a block takes the
+; same number of cycles, so the pulse length does not depend on the widths,
+; the fractions or whether a commit is pending. The pads above must be
+; updated with any change to COMMIT, COPY or DITHER.
+;
+;   Block                              Taken            Not taken
+;   BITn test of one output            4 (toggle)       4 (BITn_N skip)
+;   Step: 8 BITn + output + IDLE       41               -
+;   Pulse: 255 steps                   10455            -
+;   Pulse prologue, LSB_NE/START_PULSE 12               -
+;   COPY of n bytes                    6n+2             -
+;   COMMIT block at the pulse end      234 (COMMIT)     234 (COMMIT_PAD)
+;   DITHER block, BRIGHT phase         295 (DITHER)     295 (DITHER_PAD)
+;   DITHER block, DULL phase           -                295 (DITHER_PAD_DULL)
+;   RESET check                        7                -
+;
+; With the PWM running continuously (periods 1 and 0), each pulse also goes
+; through the period checks of both phases, 20 cycles, which makes every
+; pulse 11023 cycles long. Pulses at a change between the BRIGHT and DULL
+; phases of a blink are a few cycles longer.
 
 ; R1 (LSB) and R2 (MSB) are used to count the number of pulses in a given phase
 
@@ -50,6 +104,11 @@ START:
 ; If needed apply only to required pins
     mov P1_DRIVE_EN, #0xFF
 
+; Apply the duty cycles staged while the controller was stopped
+    mov  A, PWM_COMMIT
+    jz   RESET
+    acall COMMIT
+
 ;****************************************************************************
 ;   BRIGHT phase
 ;****************************************************************************
@@ -70,6 +129,25 @@ BRIGHT_START:
     mov  R1, #0
     mov  R2, #0
     ajmp DULL_START
+
+; Outputs not toggled at this step. The jumps take as long as the toggles.
+
+BIT0_N:
+    sjmp BIT1
+BIT1_N:
+    sjmp BIT2
+BIT2_N:
+    sjmp BIT3
+BIT3_N:
+    sjmp BIT4
+BIT4_N:
+    sjmp BIT5
+BIT5_N:
+    sjmp BIT6
+BIT6_N:
+    sjmp BIT7
+BIT7_N:
+    sjmp DONE
    
 MSB_NE:
 
@@ -91,28 +169,28 @@ START_PULSE:
     mov  TEMP, INIT_STATE
 
 BIT0:
-    cjne A, SHARED_MEM, BIT1
+    cjne A, SHARED_MEM, BIT0_N
     xrl  TEMP, #1
 BIT1:
-    cjne A, SHARED_MEM+1, BIT2
+    cjne A, SHARED_MEM+1, BIT1_N
     xrl  TEMP, #2
 BIT2:
-    cjne A, SHARED_MEM+2, BIT3
+    cjne A, SHARED_MEM+2, BIT2_N
     xrl  TEMP, #4
 BIT3:
-    cjne A, SHARED_MEM+3, BIT4
+    cjne A, SHARED_MEM+3, BIT3_N
     xrl  TEMP, #8
 BIT4:
-    cjne A, SHARED_MEM+4, BIT5
+    cjne A, SHARED_MEM+4, BIT4_N
     xrl  TEMP, #16
 BIT5:
-    cjne A, SHARED_MEM+5, BIT6
+    cjne A, SHARED_MEM+5, BIT5_N
     xrl  TEMP, #32
 BIT6:
-    cjne A, SHARED_MEM+6, BIT7
+    cjne A, SHARED_MEM+6, BIT6_N
     xrl  TEMP, #64
 BIT7:
-    cjne A, SHARED_MEM+7, DONE
+    cjne A, SHARED_MEM+7, BIT7_N
     xrl  TEMP, #128
 DONE:
 
@@ -128,7 +206,7 @@ IDLE:
     cjne R0, #IDLE_COUNT, IDLE   ; Change loop count for corse step size adjustment
 
 ; Finer adjustment of step size. Add or remove NOPs below
-    nop
+;    nop
 ;    nop
 ;    nop
 
@@ -140,6 +218,36 @@ IDLE:
 ; Even finer adjustment of pulse frequency can be done by adding NOPs here
 ;   nop
 
+; Apply the staged duty cycles at the end of each pulse, so that all the
+; outputs change together
+
+    mov  A, PWM_COMMIT
+    jz   NO_COMMIT
+    acall COMMIT
+    sjmp COMMIT_DONE
+
+NO_COMMIT:
+
+    mov  R3, #COMMIT_PAD
+    acall DELAY
+
+COMMIT_DONE:
+
+; Add the fractions of the duty cycles in high resolution mode
+
+    mov  A, PWM_HIRES
+    jz   NO_DITHER
+    acall DITHER
+    sjmp DITHER_DONE
+
+NO_DITHER:
+
+    mov  R3, #DITHER_PAD
+    acall DELAY
+    nop
+
+DITHER_DONE:
+
 ; Check RESET at the end of each pulse
 
     mov  A, PWM_RESET
@@ -168,6 +276,25 @@ DULL_START:
     mov  A, R2
     cjne A, DULL_PERIOD+1, MSB_NE2
     ajmp RESET
+
+; Outputs not toggled at this step. The jumps take as long as the toggles.
+
+BIT0_2_N:
+    sjmp BIT1_2
+BIT1_2_N:
+    sjmp BIT2_2
+BIT2_2_N:
+    sjmp BIT3_2
+BIT3_2_N:
+    sjmp BIT4_2
+BIT4_2_N:
+    sjmp BIT5_2
+BIT5_2_N:
+    sjmp BIT6_2
+BIT6_2_N:
+    sjmp BIT7_2
+BIT7_2_N:
+    sjmp DONE2
     
 MSB_NE2:
 
@@ -188,28 +315,28 @@ START_PULSE2:
     mov  A, #0
     mov  TEMP, INIT_STATE
 BIT0_2:
-    cjne A, SHARED_MEM+8, BIT1_2
+    cjne A, SHARED_MEM+8, BIT0_2_N
     xrl  TEMP, #1
 BIT1_2:
-    cjne A, SHARED_MEM+9, BIT2_2
+    cjne A, SHARED_MEM+9, BIT1_2_N
     xrl  TEMP, #2
 BIT2_2:
-    cjne A, SHARED_MEM+10, BIT3_2
+    cjne A, SHARED_MEM+10, BIT2_2_N
     xrl  TEMP, #4
 BIT3_2:
-    cjne A, SHARED_MEM+11, BIT4_2
+    cjne A, SHARED_MEM+11, BIT3_2_N
     xrl  TEMP, #8
 BIT4_2:
-    cjne A, SHARED_MEM+12, BIT5_2
+    cjne A, SHARED_MEM+12, BIT4_2_N
     xrl  TEMP, #16
 BIT5_2:
-    cjne A, SHARED_MEM+13, BIT6_2
+    cjne A, SHARED_MEM+13, BIT5_2_N
     xrl  TEMP, #32
 BIT6_2:
-    cjne A, SHARED_MEM+14, BIT7_2
+    cjne A, SHARED_MEM+14, BIT6_2_N
     xrl  TEMP, #64
 BIT7_2:
-    cjne A, SHARED_MEM+15, DONE2
+    cjne A, SHARED_MEM+15, BIT7_2_N
     xrl  TEMP, #128
 DONE2:
 
@@ -223,7 +350,7 @@ IDLE2:
     cjne R0, #IDLE_COUNT, IDLE2   ; Change loop count for corse step size adjustment
 
 ; Finer adjustment of step size. Add or remove NOPs below
-    nop
+;    nop
 ;    nop
 ;    nop
 
@@ -234,6 +361,25 @@ IDLE2:
 ; Even finer adjustment of pulse frequency can be done by adding NOPs here
 ;   nop
 
+; Apply the staged duty cycles at the end of each pulse
+
+    mov  A, PWM_COMMIT
+    jz   NO_COMMIT2
+    acall COMMIT
+    sjmp COMMIT_DONE2
+
+NO_COMMIT2:
+
+    mov  R3, #COMMIT_PAD
+    acall DELAY
+
+COMMIT_DONE2:
+
+; Take as long as the high resolution mode does in the BRIGHT phase
+
+    mov  R3, #DITHER_PAD_DULL
+    acall DELAY
+
 ; Check RESET at the end of each pulse
 
     mov  A, PWM_RESET
@@ -248,3 +394,125 @@ DO_RESET2:
 NO_RESET2:
 
     ajmp     DULL_START
+
+;****************************************************************************
+; COMMIT: copies the staged duty cycles and initial states to the active ones,
+; and the staged BRIGHT duty cycles and their fractions to the high resolution
+; mode, then clears COMMIT. R1 holds the pulse count, so it is saved on the
+; stack.
+;****************************************************************************
+
+COMMIT:
+
+    push R1_ADDR
+
+    mov  R0, #STAGED_MEM
+    mov  R1, #SHARED_MEM
+    mov  R3, #STAGED_SIZE
+    acall COPY
+
+    mov  R0, #STAGED_MEM
+    mov  R1, #BASE_WIDTH
+    mov  R3, #8
+    acall COPY
+
+    mov  R0, #STAGED_FRACTION
+    mov  R1, #FRACTION
+    mov  R3, #8
+    acall COPY
+
+    mov  PWM_COMMIT, #0
+    pop  R1_ADDR
+    ret
+
+;****************************************************************************
+; COPY: copies R3 bytes from @R0 to @R1
+;****************************************************************************
+
+COPY:
+
+    mov  A, @R0
+    mov  @R1, A
+    inc  R0
+    inc  R1
+    djnz R3, COPY
+    ret
+
+;****************************************************************************
+; DELAY: waits 2*R3+2 cycles, including the return
+;****************************************************************************
+
+DELAY:
+
+    djnz R3, DELAY
+    ret
+
+;****************************************************************************
+; DITHER: adds the fraction of each BRIGHT duty cycle to its accumulator and
+; sets the active duty cycle for the next pulse to the BRIGHT duty cycle, one
+; step longer if the accumulator overflowed. A full duty cycle is not made
+; longer. The DULL duty cycle is set to the rest of the pulse, so the two
+; still add up to a full pulse. R1 holds the pulse count, so it is saved on
+; the stack. Each output takes 35 cycles whichever way the branches go.
+;****************************************************************************
+
+DITHER:
+
+    push R1_ADDR
+    mov  R0, #FRACTION
+    mov  R1, #SHARED_MEM
+
+DITHER_LOOP:
+
+    ; R3 is the fraction
+    mov  A, @R0
+    mov  R3, A
+
+    ; Add the fraction to the accumulator and keep the overflow in R3
+    mov  A, R0
+    add  A, #8
+    mov  R0, A
+    mov  A, @R0
+    add  A, R3
+    mov  @R0, A
+    clr  A
+    rlc  A
+    mov  R3, A
+
+    ; A is the BRIGHT duty cycle
+    mov  A, R0
+    add  A, #8
+    mov  R0, A
+    mov  A, @R0
+    cjne A, #255, DITHER_ADD
+    sjmp DITHER_STORE
+
+DITHER_ADD:
+
+    add  A, R3
+    nop                     ; as long as the sjmp above
+
+DITHER_STORE:
+
+    mov  @R1, A
+
+    ; The DULL duty cycle is 255 less the BRIGHT duty cycle
+    cpl  A
+    mov  R3, A
+    mov  A, R1
+    add  A, #8
+    mov  R1, A
+    mov  A, R3
+    mov  @R1, A
+
+    ; Move on to the fraction of the next output
+    mov  A, R1
+    add  A, #0xF9           ; subtracts 7
+    mov  R1, A
+    mov  A, R0
+    add  A, #0xF1           ; subtracts 15
+    mov  R0, A
+    cjne R1, #SHARED_MEM+8, DITHER_LOOP
+
+    pop  R1_ADDR
+    ret
@@ -0,0 +1,282 @@
+/******************************************************************************
+ *  Copyright Cambridge Silicon Radio Limited 2015
+ *  CSR Bluetooth Low Energy CSRmesh 1.3 Release
+ *  Application version 1.3
+ *
+ *  FILE
+ *      soft_timer.c
+ *
+ *  DESCRIPTION
+ *      This file implements the software timers. They are kept in a list
+ *      and share one SDK timer, armed for the earliest expiry. Restarting a
+ *      running timer to a later expiry, which is what the deadline timers of
+ *      the application do on every event, only updates the expiry: the SDK
+ *      timer is left to fire at the earlier time and is then armed again for
+ *      the new earliest expiry. Stopping a timer never touches the SDK timer.
+ *      The timers expiring within SOFT_TIMER_COALESCE_WINDOW of each other
+ *      are handled on the same wake up.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+#include <timer.h>
+#include <time.h>
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+#include "soft_timer.h"
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Timers expiring up to this time after the SDK timer fires are handled
+ * straight away
+ */
+#define SOFT_TIMER_COALESCE_WINDOW  (20 * MILLISECOND)
+
+/* Shortest timeout of a software timer. A timer restarted by its handler
+ * with a timeout within the coalescing window would otherwise be handled
+ * again on the same wake up, for ever.
+ */
+#define SOFT_TIMER_MIN_TIMEOUT      (SOFT_TIMER_COALESCE_WINDOW + MILLISECOND)
+
+/* Checks whether time a is before time b, across the wrap of TimeGet32 */
+#define TIME_BEFORE(a, b)           ((int32)((a) - (b)) < 0)
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* Running software timers, in no particular order */
+static SOFT_TIMER_T *running_timers;
+
+/* SDK timer shared by the software timers */
+static timer_id soft_tid;
+
+/* Time at which soft_tid fires, valid while it is armed */
+static uint32 soft_tid_expiry;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+static void armSdkTimer(uint32 expiry);
+static void armEarliest(void);
+static void softTimerHandler(timer_id tid);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      armSdkTimer
+ *
+ *  DESCRIPTION
+ *      This function arms the shared SDK timer for the given time, unless it
+ *      is already armed to fire earlier.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void armSdkTimer(uint32 expiry)
+{
+    uint32 now;
+
+    if(soft_tid != TIMER_INVALID)
+    {
+        if(!TIME_BEFORE(expiry, soft_tid_expiry))
+        {
+            return;
+        }
+        TimerDelete(soft_tid);
+    }
+
+    now = TimeGet32();
+    soft_tid_expiry = expiry;
+    soft_tid = TimerCreate(TIME_BEFORE(now, expiry) ? (expiry - now) : 0,
+                           TRUE, softTimerHandler);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      armEarliest
+ *
+ *  DESCRIPTION
+ *      This function arms the shared SDK timer for the earliest expiry of the
+ *      running timers.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void armEarliest(void)
+{
+    SOFT_TIMER_T *timer = running_timers;
+    uint32 earliest;
+
+    if(timer == NULL)
+    {
+        return;
+    }
+
+    earliest = timer->expiry;
+    for(timer = timer->next; timer != NULL; timer = timer->next)
+    {
+        if(TIME_BEFORE(timer->expiry, earliest))
+        {
+            earliest = timer->expiry;
+        }
+    }
+
+    armSdkTimer(earliest);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      softTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function handles the expiry of the shared SDK timer. It stops and
+ *      calls the handler of every timer expiring within the coalescing window,
+ *      and arms the SDK timer again for the timers left running. The list is
+ *      scanned again after each handler, which may start or stop timers.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+static void softTimerHandler(timer_id tid)
+{
+    SOFT_TIMER_T **p_link;
+    SOFT_TIMER_T *timer;
+    uint32 horizon;
+
+    if(tid != soft_tid)
+    {
+        return;
+    }
+    soft_tid = TIMER_INVALID;
+
+    horizon = TimeGet32() + SOFT_TIMER_COALESCE_WINDOW;
+
+    p_link = &running_timers;
+    while(*p_link != NULL)
+    {
+        timer = *p_link;
+
+        if(TIME_BEFORE(horizon, timer->expiry))
+        {
+            p_link = &timer->next;
+            continue;
+        }
+
+        *p_link = timer->next;
+        timer->running = FALSE;
+        timer->handler();
+
+        p_link = &running_timers;
+    }
+
+    armEarliest();
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      SoftTimerInit
+ *
+ *  DESCRIPTION
+ *      This function stops all the software timers. It must be called after
+ *      the SDK timers have been initialised.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void SoftTimerInit(void)
+{
+    SOFT_TIMER_T *timer;
+
+    for(timer = running_timers; timer != NULL; timer = timer->next)
+    {
+        timer->running = FALSE;
+    }
+    running_timers = NULL;
+    soft_tid = TIMER_INVALID;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      SoftTimerStart
+ *
+ *  DESCRIPTION
+ *      This function starts a software timer, or restarts it if it is
+ *      running, to expire after the given timeout in microseconds. Timeouts
+ *      shorter than SOFT_TIMER_MIN_TIMEOUT are lengthened to it. The SDK
+ *      timer is only armed again when the new expiry is the earliest.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void SoftTimerStart(SOFT_TIMER_T *timer, uint32 timeout,
+                           SOFT_TIMER_HANDLER_T handler)
+{
+    if(timeout < SOFT_TIMER_MIN_TIMEOUT)
+    {
+        timeout = SOFT_TIMER_MIN_TIMEOUT;
+    }
+
+    timer->expiry = TimeGet32() + timeout;
+    timer->handler = handler;
+
+    if(!timer->running)
+    {
+        timer->next = running_timers;
+        running_timers = timer;
+        timer->running = TRUE;
+    }
+
+    armSdkTimer(timer->expiry);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      SoftTimerStop
+ *
+ *  DESCRIPTION
+ *      This function stops a software timer, if it is running. The SDK timer
+ *      is left armed; it arms itself again for the timers left when it fires.
+ *
+ *  RETURNS
+ *      Nothing.
+ *
+ *---------------------------------------------------------------------------*/
+extern void SoftTimerStop(SOFT_TIMER_T *timer)
+{
+    SOFT_TIMER_T **p_link;
+
+    if(!timer->running)
+    {
+        return;
+    }
+
+    for(p_link = &running_timers; *p_link != NULL; p_link = &(*p_link)->next)
+    {
+        if(*p_link == timer)
+        {
+            *p_link = timer->next;
+            break;
+        }
+    }
+    timer->running = FALSE;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *  Copyright Cambridge Silicon Radio Limited 2015
+ *  CSR Bluetooth Low Energy CSRmesh 1.3 Release
+ *  Application version 1.3
+ *
+ *  FILE
+ *      soft_timer.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the software timers, which share a single
+ *      timer of the SDK pool.
+ *
+ *****************************************************************************/
+
+#ifndef __SOFT_TIMER_H__
+#define __SOFT_TIMER_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Handler called when a software timer expires */
+typedef void (*SOFT_TIMER_HANDLER_T)(void);
+
+/* Software timer. The storage belongs to the user of the timer; it must be
+ * zero initialised, or stopped, before its first start.
+ */
+typedef struct SOFT_TIMER_TAG
+{
+    /* Time at which the timer expires */
+    uint32                         expiry;
+
+    /* Handler called when the timer expires */
+    SOFT_TIMER_HANDLER_T           handler;
+
+    /* Next running timer */
+    struct SOFT_TIMER_TAG         *next;
+
+    /* TRUE while the timer is running */
+    bool                           running;
+
+} SOFT_TIMER_T;
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Stops all the software timers. Must be called after TimerInit */
+extern void SoftTimerInit(void);
+
+/* Starts or restarts a software timer */
+extern void SoftTimerStart(SOFT_TIMER_T *timer, uint32 timeout,
+                           SOFT_TIMER_HANDLER_T handler);
+
+/* Stops a software timer */
+extern void SoftTimerStop(SOFT_TIMER_T *timer);
+
+/* Checks whether a software timer is running */
+#define SoftTimerRunning(timer)     ((timer)->running)
+
+#endif /* __SOFT_TIMER_H__ */
@@ -27,12 +27,12 @@
  * only if the new version of the application has a different NVM structure
  * than the previous version (such as number of groups supported) that can
  * shift the offsets of the currently stored parameters.
- * If the application NVM version has changed, it could still read the values
- * from the old Offsets and store into new offsets.
- * This application currently erases all the NVM values if the NVM version has
- * changed.
+ * If the application NVM version has changed, the data of the earlier
+ * layouts listed in the migration table of csr_mesh_light.c is kept or moved
+ * to the new offsets, and only the data a migration step marks as new is
+ * reset.
  */
-#define APP_NVM_VERSION     (4)
+#define APP_NVM_VERSION     (5)
 
 #define CSR_MESH_LIGHT_PID  (0x1060)
 
@@ -95,9 +95,51 @@
 #define USE_ASSOCIATION_REMOVAL_KEY
 #endif
 
-/* Enable fast PWM using PIO controller instead of Hardware PWM */
+/* Enable fast PWM using PIO controller for the colour ramps, blinks and the
+ * colours the Hardware PWM cannot drive exactly. The PIO controller keeps the
+ * chip in shallow sleep, so the Hardware PWM still drives the other colours.
+ */
 /* #define ENABLE_FAST_PWM */
 
+/* Enable temporal dithering of the Hardware PWM on the IOT board, to drive
+ * all the 256 colour levels on its 16 level PWMs. While a colour level falls
+ * between two PWM levels the application wakes up every 625 us, 1600 times a
+ * second, and the chip does not go to deep sleep; the CPU time it takes is
+ * read with IOTLightControlDeviceGetDitherLoad. Fast PWM drives the same
+ * levels from the PIO controller with no wake ups and takes precedence.
+ */
+/* #define ENABLE_PWM_DITHERING */
+
+/* Time each phase of AppInit, including the time until the light is restored
+ * from NVM, and report them on the debug UART.
+ */
+/* #define ENABLE_BOOT_TIMING */
+
+/* Record the number, size and duration of the NVM accesses made at each site
+ * of the NVM store. The statistics are read over the data model stream.
+ */
+/* #define ENABLE_NVM_STATS */
+
+/* Record the number of CSRmesh events processed and their minimum, average
+ * and maximum processing times for each event code. The statistics are read
+ * over the data model stream.
+ */
+/* #define ENABLE_MESH_EVENT_STATS */
+
+/* Check at boot that the brightness look up table of the IOT board is
+ * strictly increasing, and panic otherwise. Only needed while editing the
+ * table.
+ */
+/* #define ENABLE_LEVEL_LUT_CHECK */
+
+/* Record the application events in a RAM trace ring, drained to the debug
+ * UART from a timer, instead of writing them to the UART from the event
+ * handlers. Needs the debug UART.
+ */
+#ifdef DEBUG_ENABLE
+#define ENABLE_TRACE
+#endif
+
 /* Enables Authorization Code on Device. */
 /* #define USE_AUTHORIZATION_CODE */
 